@@ -3,14 +3,18 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <charconv>
+#include <chrono>
 #include <concepts>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <memory>
 #include <numeric>
 #include <ranges>
 #include <string_view>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -27,6 +31,29 @@ inline auto getStdinView() {
   return std::make_pair(std::move(unq_ptr), std::string_view(ptr, size));
 }
 
+// Reads stdin (which may be a pipe) in chunks of up to chunk_size new bytes
+// and calls fn(chunk, offset) for each, where offset is the position of the
+// chunk in the stream. Every chunk is prefixed with the last (up to) overlap
+// bytes of the previous one
+inline void forEachStdinChunk(size_t chunk_size, size_t overlap, auto &&fn) {
+  std::vector<char> buffer(overlap + chunk_size);
+  size_t carry = 0, offset = 0;
+  for (;;) {
+    const auto n_read = read(STDIN_FILENO, buffer.data() + carry, chunk_size);
+    if (n_read < 0)
+      throw std::runtime_error{"read failed"};
+    if (n_read == 0)
+      return;
+    const auto size = carry + static_cast<size_t>(n_read);
+    std::invoke(fn, std::string_view{buffer.data(), size}, offset);
+    const auto new_carry = std::min(overlap, size);
+    std::copy(buffer.data() + size - new_carry, buffer.data() + size,
+              buffer.data());
+    offset += size - new_carry;
+    carry = new_carry;
+  }
+}
+
 inline auto splitIntoSections(std::string_view in) {
   return in | std::views::split("\n\n"sv) |
          std::views::transform([](auto &&r) { return std::string_view{r}; });
@@ -46,6 +73,10 @@ inline auto splitLineIntoWordsFilterEmpty(std::string_view line) {
              [](std::string_view word) { return not word.empty(); });
 }
 
+inline auto getArgs(int argc, char *argv[]) -> std::vector<std::string_view> {
+  return {std::next(argv), std::next(argv, argc)};
+}
+
 template <typename T>
 T toNumber(auto &&str_range)
   requires std::integral<T> or std::floating_point<T>
@@ -57,3 +88,59 @@ T toNumber(auto &&str_range)
 }
 
 int toInt(auto &&str) { return toNumber<int>(str); }
+
+inline auto getNumThreads() -> size_t {
+  return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+// Invokes task(i) for every i in [0, n_tasks), spread over the available cores
+inline void parallelFor(size_t n_tasks, auto &&task) {
+  std::atomic<size_t> next_task{};
+  const auto worker = [&] {
+    for (auto i = next_task++; i < n_tasks; i = next_task++)
+      std::invoke(task, i);
+  };
+  std::vector<std::jthread> threads;
+  for (size_t t = 1; t < std::min(n_tasks, getNumThreads()); ++t)
+    threads.emplace_back(worker);
+  worker();
+}
+
+// Partitions [0, n) into blocks of at least min_block_size elements (except
+// for n < min_block_size) and invokes task(begin, end) for each, in parallel
+inline void parallelForBlocks(size_t n, size_t min_block_size, auto &&task) {
+  const auto n_blocks = std::clamp(n / std::max(min_block_size, size_t{1}),
+                                   size_t{1}, 4 * getNumThreads());
+  parallelFor(n_blocks, [&](size_t block) {
+    std::invoke(task, block * n / n_blocks, (block + 1) * n / n_blocks);
+  });
+}
+
+// Sorts [begin, end) by sorting blocks in parallel, then merging adjacent
+// sorted runs pairwise in parallel rounds
+inline void parallelSort(std::random_access_iterator auto begin,
+                         std::random_access_iterator auto end, auto comp) {
+  constexpr size_t min_block_size = 1ul << 14;
+  const auto n = static_cast<size_t>(std::distance(begin, end));
+  const auto n_blocks =
+      std::clamp(n / min_block_size, size_t{1}, getNumThreads());
+  const auto at = [&](size_t block) {
+    return std::next(begin, static_cast<ptrdiff_t>(block * n / n_blocks));
+  };
+  parallelFor(n_blocks,
+              [&](size_t block) { std::sort(at(block), at(block + 1), comp); });
+  for (size_t width = 1; width < n_blocks; width *= 2)
+    parallelFor((n_blocks + 2 * width - 1) / (2 * width), [&](size_t pair) {
+      const auto first = 2 * width * pair;
+      std::inplace_merge(at(first), at(std::min(first + width, n_blocks)),
+                         at(std::min(first + 2 * width, n_blocks)), comp);
+    });
+}
+
+// Wall time of a single invocation of fn, in seconds
+inline double measureSeconds(auto &&fn) {
+  const auto start = std::chrono::steady_clock::now();
+  std::invoke(fn);
+  const auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(stop - start).count();
+}
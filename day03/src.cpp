@@ -12,49 +12,100 @@ constexpr auto priority_map = std::invoke([] {
   return retval;
 });
 
-void part1(std::string_view data) {
-  auto priority_view =
-      splitIntoLinesUntilEmpty(data) | std::views::transform([](auto &&ruck) {
-        std::array<bool, 256> content_map{};
-        const auto half_sz = std::ranges::size(ruck) / 2;
-        for (auto c : ruck | std::views::take(half_sz))
-          content_map[c] = true;
-        const auto repeated =
-            *std::ranges::find_if(ruck | std::views::drop(half_sz),
-                                  [&](char c) { return content_map[c]; });
-        return priority_map[repeated];
-      }) |
-      std::views::common;
-  std::cout << std::reduce(priority_view.begin(), priority_view.end(), size_t{})
-            << '\n';
+constexpr size_t group_size = 3;
+
+auto getRepeatedItemPriority(std::string_view ruck) -> size_t {
+  std::array<bool, 256> content_map{};
+  const auto half_sz = ruck.size() / 2;
+  for (auto c : ruck.substr(0, half_sz))
+    content_map[c] = true;
+  const auto repeated = *std::ranges::find_if(
+      ruck.substr(half_sz), [&](char c) { return content_map[c]; });
+  return priority_map[repeated];
 }
 
-void part2(std::string_view data) {
-  std::vector<std::string_view> lines;
-  std::ranges::transform(splitIntoLinesUntilEmpty(data) | std::views::common,
-                         std::back_inserter(lines), [](auto &&subr) {
-                           return std::string_view{subr.begin(), subr.end()};
-                         });
-  int sum{};
-  // No std::views::chunked in gcc12 ...
-  for (size_t i = 0; i < lines.size(); i += 3) {
-    std::array<std::array<bool, 2>, 256> content_map{};
-    for (size_t j = 0;
-         auto line : lines | std::views::drop(i) | std::views::take(2)) {
+struct Priorities {
+  size_t items, badges;
+};
+
+// Single pass over the lines of the chunk, which must start at a group boundary
+auto sumPriorities(std::string_view chunk) -> Priorities {
+  Priorities retval{};
+  auto lines = splitIntoLinesUntilEmpty(chunk);
+  for (auto line_it = lines.begin(); line_it != lines.end();) {
+    std::array<std::array<bool, group_size - 1>, 256> content_map{};
+    for (size_t j = 0; j < group_size - 1 and line_it != lines.end();
+         ++j, ++line_it) {
+      const std::string_view line = *line_it;
+      retval.items += getRepeatedItemPriority(line);
       for (auto c : line)
         content_map[c][j] = true;
-      ++j;
     }
-    const auto repeated = *std::ranges::find_if(lines[i + 2], [&](char c) {
+    if (line_it == lines.end())
+      break;
+    const std::string_view line = *line_it++;
+    retval.items += getRepeatedItemPriority(line);
+    const auto repeated = *std::ranges::find_if(line, [&](char c) {
       return std::ranges::all_of(content_map[c], std::identity{});
     });
-    sum += priority_map[repeated];
+    retval.badges += priority_map[repeated];
+  }
+  return retval;
+}
+
+// Returns the start of the first line beginning at or after pos
+auto getLineStart(std::string_view data, size_t pos) -> size_t {
+  if (pos == 0)
+    return 0;
+  return std::min(data.find('\n', pos - 1), data.size() - 1) + 1;
+}
+
+// Splits the input into (at most) n_chunks chunks, each starting at a line
+// whose index is a multiple of group_size
+auto splitIntoGroupAlignedChunks(std::string_view data, size_t n_chunks)
+    -> std::vector<std::string_view> {
+  std::vector<size_t> line_starts(n_chunks + 1, data.size()),
+      n_lines(n_chunks);
+  for (size_t i = 0; i < n_chunks; ++i)
+    line_starts[i] = getLineStart(data, i * data.size() / n_chunks);
+  parallelFor(n_chunks, [&](size_t i) {
+    n_lines[i] = static_cast<size_t>(std::count(
+        std::next(data.begin(), static_cast<ptrdiff_t>(line_starts[i])),
+        std::next(data.begin(), static_cast<ptrdiff_t>(line_starts[i + 1])),
+        '\n'));
+  });
+
+  std::vector<std::string_view> retval;
+  retval.reserve(n_chunks);
+  for (size_t i = 0, lines_before = 0, chunk_begin = 0; i < n_chunks; ++i) {
+    lines_before += n_lines[i];
+    auto chunk_end = line_starts[i + 1];
+    for (auto skip = (group_size - lines_before % group_size) % group_size;
+         skip > 0 and chunk_end < data.size(); --skip)
+      chunk_end = getLineStart(data, chunk_end + 1);
+    retval.push_back(data.substr(chunk_begin, chunk_end - chunk_begin));
+    chunk_begin = chunk_end;
   }
-  std::cout << sum << '\n';
+  return retval;
+}
+
+void part1And2(std::string_view data) {
+  constexpr size_t min_chunk_size = 1ul << 16;
+  const auto n_chunks =
+      std::min(getNumThreads(), data.size() / min_chunk_size + 1);
+  const auto chunks = splitIntoGroupAlignedChunks(data, n_chunks);
+  std::vector<Priorities> partial_sums(chunks.size());
+  parallelFor(chunks.size(),
+              [&](size_t i) { partial_sums[i] = sumPriorities(chunks[i]); });
+  const auto [items, badges] = std::reduce(
+      partial_sums.begin(), partial_sums.end(), Priorities{},
+      [](Priorities a, Priorities b) {
+        return Priorities{a.items + b.items, a.badges + b.badges};
+      });
+  std::cout << items << '\n' << badges << '\n';
 }
 
 int main() {
   const auto [alloc, data] = getStdinView();
-  part1(data);
-  part2(data);
+  part1And2(data);
 }
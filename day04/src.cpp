@@ -1,48 +1,282 @@
 #include "../common/common.hpp"
 
-auto parseLoHi(auto &&str) -> std::array<int, 2> {
-  auto lohi_pairs = str | std::views::split("-"sv);
-  auto it = std::ranges::begin(lohi_pairs);
-  const auto lo = toInt(*it++);
-  const auto hi = toInt(*it);
-  return std::array{lo, hi};
-}
-
-auto getAssignmentsView(std::string_view data) {
-  return splitIntoLinesUntilEmpty(data) |
-         std::views::transform([](std::string_view line) {
-           auto pairs = line | std::views::split(","sv);
-           auto it = std::ranges::begin(pairs);
-           const auto first_lohi = parseLoHi(*it++);
-           const auto second_lohi = parseLoHi(*it);
-           return std::make_pair(first_lohi, second_lohi);
-         });
-}
-
-void part1(std::string_view data) {
-  const auto num_overlapping =
-      std::ranges::count_if(getAssignmentsView(data), [](const auto &pair) {
-        const auto &[p1, p2] = pair;
-        const auto [lo1, hi1] = p1;
-        const auto [lo2, hi2] = p2;
-        return (lo1 <= lo2 and hi1 >= hi2) or (lo2 <= lo1 and hi2 >= hi1);
-      });
-  std::cout << num_overlapping << '\n';
-}
-
-void part2(std::string_view data) {
-  const auto num_subsuming =
-      std::ranges::count_if(getAssignmentsView(data), [](const auto &pair) {
-        const auto &[p1, p2] = pair;
-        const auto [lo1, hi1] = p1;
-        const auto [lo2, hi2] = p2;
-        return (lo1 <= hi2 and hi1 >= lo2) or (lo2 <= hi1 and hi2 >= lo1);
-      });
-  std::cout << num_subsuming << '\n';
-}
-
-int main() {
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <span>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+// Structure of arrays holding the assignment pairs lo1-hi1,lo2-hi2
+struct Assignments {
+  std::vector<int> lo1, hi1, lo2, hi2;
+
+  size_t size() const { return lo1.size(); }
+  void push_back(std::array<int, 4> pair) {
+    lo1.push_back(pair[0]);
+    hi1.push_back(pair[1]);
+    lo2.push_back(pair[2]);
+    hi2.push_back(pair[3]);
+  }
+};
+
+constexpr size_t block_size = 16;
+
+// Bit i is set iff block[i] is not a decimal digit
+auto getDelimiterMask(const char *block) -> std::uint32_t {
+#ifdef __SSE2__
+  const auto chars =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+  const auto is_digit =
+      _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+                    _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+  return ~static_cast<std::uint32_t>(_mm_movemask_epi8(is_digit)) & 0xffffu;
+#else
+  std::uint32_t retval{};
+  for (size_t i = 0; i < block_size; ++i)
+    retval |= static_cast<std::uint32_t>(block[i] < '0' or block[i] > '9') << i;
+  return retval;
+#endif
+}
+
+auto parseDigits(const char *begin, const char *end) -> int {
+  int retval{};
+  for (; begin != end; ++begin)
+    retval = retval * 10 + (*begin - '0');
+  return retval;
+}
+
+// Parses one "a-b,c-d\n" record located at the start of block. Returns the 4
+// numbers and the record length (including the newline), or a length of 0 if
+// the record does not fit in the block or has other delimiters (e.g. "\r\n")
+auto parseRecord(const char *block) -> std::pair<std::array<int, 4>, size_t> {
+  constexpr auto expected_delims = "-,-\n"sv;
+  auto delims = getDelimiterMask(block);
+  if (std::popcount(delims) < 4)
+    return {{}, 0};
+  std::array<int, 4> retval;
+  const char *num_begin = block;
+  for (size_t i = 0; auto &num : retval) {
+    const char *num_end = block + std::countr_zero(delims);
+    if (*num_end != expected_delims[i++])
+      return {{}, 0};
+    num = parseDigits(num_begin, num_end);
+    num_begin = num_end + 1;
+    delims &= delims - 1;
+  }
+  return {retval, static_cast<size_t>(num_begin - block)};
+}
+
+// Slow path for records which are too long for the vectorized parser
+auto parseRecordScalar(std::string_view line) -> std::array<int, 4> {
+  std::array<int, 4> retval;
+  for (auto &num : retval) {
+    const auto num_end = std::min(line.find_first_of("-,"sv), line.size());
+    num = toInt(line.substr(0, num_end));
+    line.remove_prefix(std::min(num_end + 1, line.size()));
+  }
+  return retval;
+}
+
+auto parseAssignments(std::string_view data) -> Assignments {
+  Assignments retval;
+  std::array<char, block_size> tail_block;
+  while (not data.empty() and data.front() != '\n') {
+    // Near the end of the buffer, parse from a newline-padded copy
+    const char *block = data.data();
+    if (data.size() < block_size) {
+      tail_block.fill('\n');
+      std::memcpy(tail_block.data(), data.data(), data.size());
+      block = tail_block.data();
+    }
+    const auto [pair, length] = parseRecord(block);
+    if (length != 0) {
+      retval.push_back(pair);
+      data.remove_prefix(std::min(length, data.size()));
+    } else {
+      const auto line_end = std::min(data.find('\n'), data.size());
+      retval.push_back(parseRecordScalar(data.substr(0, line_end)));
+      data.remove_prefix(std::min(line_end + 1, data.size()));
+    }
+  }
+  return retval;
+}
+
+struct Counts {
+  size_t subsuming, overlapping;
+};
+
+auto countSubsumingAndOverlapping(const Assignments &as) -> Counts {
+  size_t subsuming{}, overlapping{};
+  for (size_t i = 0; i < as.size(); ++i) {
+    const auto lo1 = as.lo1[i], hi1 = as.hi1[i], lo2 = as.lo2[i],
+               hi2 = as.hi2[i];
+    subsuming += static_cast<size_t>(((lo1 <= lo2) & (hi1 >= hi2)) |
+                                     ((lo2 <= lo1) & (hi2 >= hi1)));
+    overlapping += static_cast<size_t>((lo1 <= hi2) & (lo2 <= hi1));
+  }
+  return {subsuming, overlapping};
+}
+
+// Static index over all ranges of all assignment pairs. Counting queries are
+// answered from the sorted endpoints (the number of ranges with lo <= x minus
+// the number of ranges with hi < x), reporting queries descend a max-hi
+// segment tree built over the ranges sorted by lo
+class IntervalIndex {
+public:
+  IntervalIndex(const Assignments &as) {
+    ranges_.reserve(2 * as.size());
+    for (size_t i = 0; i < as.size(); ++i) {
+      ranges_.push_back({as.lo1[i], as.hi1[i], i});
+      ranges_.push_back({as.lo2[i], as.hi2[i], i});
+    }
+    std::ranges::sort(ranges_, {}, &Range::lo);
+    sorted_lo_.reserve(ranges_.size());
+    sorted_hi_.reserve(ranges_.size());
+    std::ranges::transform(ranges_, std::back_inserter(sorted_lo_),
+                           &Range::lo);
+    std::ranges::transform(ranges_, std::back_inserter(sorted_hi_),
+                           &Range::hi);
+    std::ranges::sort(sorted_hi_);
+
+    leaves_ = std::bit_ceil(std::max(ranges_.size(), size_t{1}));
+    max_hi_.assign(2 * leaves_, std::numeric_limits<int>::min());
+    std::ranges::transform(ranges_, std::next(max_hi_.begin(), leaves_),
+                           &Range::hi);
+    for (size_t node = leaves_ - 1; node > 0; --node)
+      max_hi_[node] = std::max(max_hi_[2 * node], max_hi_[2 * node + 1]);
+  }
+
+  // Number of ranges containing section
+  size_t countCovering(int section) const {
+    return countOverlapping(section, section);
+  }
+  // Number of ranges overlapping [lo, hi], requires lo <= hi
+  size_t countOverlapping(int lo, int hi) const {
+    const auto n_starting_before = std::ranges::upper_bound(sorted_lo_, hi);
+    const auto n_ending_before = std::ranges::lower_bound(sorted_hi_, lo);
+    return static_cast<size_t>(
+        std::distance(sorted_lo_.begin(), n_starting_before) -
+        std::distance(sorted_hi_.begin(), n_ending_before));
+  }
+  // Calls visitor(pair_index) for every range overlapping [lo, hi], in
+  // O(log(n) * (k + 1)) for k reported ranges. Requires lo <= hi
+  void visitOverlapping(int lo, int hi, auto &&visitor) const {
+    const auto n_candidates = static_cast<size_t>(std::distance(
+        sorted_lo_.begin(), std::ranges::upper_bound(sorted_lo_, hi)));
+    visitNode(1, 0, leaves_, n_candidates, lo, visitor);
+  }
+
+private:
+  struct Range {
+    int lo, hi;
+    size_t pair;
+  };
+
+  void visitNode(size_t node, size_t node_begin, size_t node_end,
+                 size_t n_candidates, int lo, auto &visitor) const {
+    if (node_begin >= n_candidates or max_hi_[node] < lo)
+      return;
+    if (node >= leaves_) {
+      std::invoke(visitor, ranges_[node_begin].pair);
+      return;
+    }
+    const auto mid = (node_begin + node_end) / 2;
+    visitNode(2 * node, node_begin, mid, n_candidates, lo, visitor);
+    visitNode(2 * node + 1, mid, node_end, n_candidates, lo, visitor);
+  }
+
+  std::vector<Range> ranges_;
+  std::vector<int> sorted_lo_, sorted_hi_, max_hi_;
+  size_t leaves_{};
+};
+
+void part1And2(const Assignments &assignments) {
+  const auto [subsuming, overlapping] =
+      countSubsumingAndOverlapping(assignments);
+  std::cout << subsuming << '\n' << overlapping << '\n';
+}
+
+// Queries are given on the command line, e.g. `cover 42 overlap 10 20`
+void runQueries(const IntervalIndex &index,
+                std::span<const std::string_view> args) {
+  while (not args.empty()) {
+    if (args.front() == "cover"sv and args.size() >= 2) {
+      const auto section = toInt(args[1]);
+      std::cout << "cover " << section << ": " << index.countCovering(section)
+                << '\n';
+      args = args.subspan(2);
+    } else if (args.front() == "overlap"sv and args.size() >= 3) {
+      const auto lo = toInt(args[1]), hi = toInt(args[2]);
+      if (lo > hi)
+        throw std::runtime_error{"invalid query: overlap bounds reversed"};
+      std::vector<size_t> pairs;
+      index.visitOverlapping(lo, hi, [&](size_t p) { pairs.push_back(p); });
+      std::ranges::sort(pairs);
+      const auto [last, end] = std::ranges::unique(pairs);
+      pairs.erase(last, end);
+      std::cout << "overlap " << lo << '-' << hi << ": "
+                << index.countOverlapping(lo, hi) << " ranges in "
+                << pairs.size() << " pairs (lines";
+      for (auto p : pairs)
+        std::cout << ' ' << p + 1;
+      std::cout << ")\n";
+      args = args.subspan(3);
+    } else
+      throw std::runtime_error{"invalid query"};
+  }
+}
+
+void benchmark(size_t n_pairs) {
+  constexpr int max_section = 1'000'000;
+  constexpr size_t n_queries = 10'000'000;
+  std::mt19937 gen{42};
+  std::uniform_int_distribution<int> section_dist{1, max_section},
+      length_dist{0, 1000};
+  const auto makeRange = [&] {
+    const auto lo = section_dist(gen);
+    return std::array{lo, std::min(lo + length_dist(gen), max_section)};
+  };
+  Assignments assignments;
+  for (size_t i = 0; i < n_pairs; ++i) {
+    const auto [lo1, hi1] = makeRange();
+    const auto [lo2, hi2] = makeRange();
+    assignments.push_back({lo1, hi1, lo2, hi2});
+  }
+  std::vector<std::array<int, 2>> queries(n_queries);
+  std::ranges::generate(queries, makeRange);
+
+  std::optional<IntervalIndex> index;
+  const auto build_time = measureSeconds([&] { index.emplace(assignments); });
+  size_t checksum{};
+  const auto cover_time = measureSeconds([&] {
+    for (const auto &q : queries)
+      checksum += index->countCovering(q.front());
+  });
+  const auto overlap_time = measureSeconds([&] {
+    for (const auto &[lo, hi] : queries)
+      checksum += index->countOverlapping(lo, hi);
+  });
+  std::cout << n_pairs << " pairs, index built in " << build_time << " s\n"
+            << "cover:   " << n_queries / cover_time << " queries/s\n"
+            << "overlap: " << n_queries / overlap_time << " queries/s\n"
+            << "(checksum " << checksum << ")\n";
+}
+
+int main(int argc, char *argv[]) {
+  const auto args = getArgs(argc, argv);
+  if (not args.empty() and args.front() == "bench"sv) {
+    benchmark(args.size() > 1 ? toNumber<size_t>(args[1]) : 1'000'000);
+    return 0;
+  }
   const auto [alloc, data] = getStdinView();
-  part1(data);
-  part2(data);
+  const auto assignments = parseAssignments(data);
+  if (args.empty())
+    part1And2(assignments);
+  else
+    runQueries(IntervalIndex{assignments}, args);
 }
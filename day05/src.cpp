@@ -1,59 +1,182 @@
 #include "../common/common.hpp"
 
+#include <cstdint>
+#include <random>
+#include <span>
 #include <string>
 
 struct Move {
   int from, to, count;
 };
 
-class Stacks {
+// Crates are stored in implicit treaps (ropes) sharing one node pool, so that
+// moving a block of k crates is a split and a merge, O(log n) regardless of k.
+// Reversing a block only toggles a lazy flag on its root
+class CrateRopes {
 public:
-  Stacks(std::string_view section) {
-    auto lines = splitIntoLinesUntilEmpty(section);
-    const auto n_lines = std::ranges::distance(lines);
-    for (auto &&line : lines | std::views::take(n_lines - 1)) {
-      for (auto it = std::ranges::begin(line), end = std::ranges::end(line);;
-           ++it) {
-        it =
-            std::find_if(it, end, [](char c) { return c >= 'A' and c <= 'Z'; });
-        if (it == end)
-          break;
-        const auto pos = std::distance(std::ranges::begin(line), it);
-        const auto stack_ind = (pos - 1) / 4;
-        if (data_.size() <= static_cast<size_t>(stack_ind))
-          data_.resize(stack_ind + 1);
-        data_[stack_ind].push_back(*it);
-      }
+  using node_t = std::uint32_t;
+  static constexpr node_t null_node = 0;
+
+  CrateRopes() : nodes_(1) {}
+
+  auto makeNode(char crate) -> node_t {
+    nodes_.push_back(Node{.priority = static_cast<std::uint32_t>(rng_()),
+                          .size = 1,
+                          .crate = crate});
+    return static_cast<node_t>(nodes_.size() - 1);
+  }
+  auto size(node_t n) const -> size_t { return nodes_[n].size; }
+
+  // Concatenates the sequences l and r
+  auto merge(node_t l, node_t r) -> node_t {
+    if (l == null_node or r == null_node)
+      return l == null_node ? r : l;
+    if (nodes_[l].priority > nodes_[r].priority) {
+      push(l);
+      nodes_[l].right = merge(nodes_[l].right, r);
+      return update(l);
+    }
+    push(r);
+    nodes_[r].left = merge(l, nodes_[r].left);
+    return update(r);
+  }
+  // Splits the sequence n into its first count elements and the rest
+  auto split(node_t n, size_t count) -> std::pair<node_t, node_t> {
+    if (n == null_node)
+      return {null_node, null_node};
+    push(n);
+    const auto left = nodes_[n].left;
+    if (count <= size(left)) {
+      const auto [ll, lr] = split(left, count);
+      nodes_[n].left = lr;
+      return {ll, update(n)};
     }
-    for (auto &stack : data_)
-      std::ranges::reverse(stack);
+    const auto [rl, rr] = split(nodes_[n].right, count - size(left) - 1);
+    nodes_[n].right = rl;
+    return {update(n), rr};
+  }
+  void reverse(node_t n) {
+    if (n != null_node)
+      nodes_[n].reversed = not nodes_[n].reversed;
+  }
+  // Last element of the sequence n, which must not be empty
+  auto back(node_t n) -> char {
+    for (;;) {
+      push(n);
+      if (nodes_[n].right == null_node)
+        return nodes_[n].crate;
+      n = nodes_[n].right;
+    }
+  }
+
+private:
+  struct Node {
+    node_t left{}, right{};
+    std::uint32_t priority{}, size{};
+    char crate{};
+    bool reversed{};
+  };
+
+  void push(node_t n) {
+    auto &node = nodes_[n];
+    if (not node.reversed)
+      return;
+    std::swap(node.left, node.right);
+    reverse(node.left);
+    reverse(node.right);
+    node.reversed = false;
+  }
+  auto update(node_t n) -> node_t {
+    auto &node = nodes_[n];
+    node.size = static_cast<std::uint32_t>(1 + size(node.left) +
+                                           size(node.right));
+    return n;
+  }
+
+  std::vector<Node> nodes_;
+  std::minstd_rand rng_;
+};
+
+// Crates of each stack, bottom to top
+using Crates = std::vector<std::vector<char>>;
+
+// Reported as the top crate of an empty stack
+constexpr char empty_stack_top = ' ';
+
+// The number of stacks is taken from the label line, as stacks on the right
+// may start out empty
+auto parseCrates(std::string_view section) -> Crates {
+  auto lines = splitIntoLinesUntilEmpty(section);
+  const auto n_lines = std::ranges::distance(lines);
+  if (n_lines == 0)
+    throw std::runtime_error{"missing stack labels"};
+  const std::string_view labels =
+      *std::ranges::next(lines.begin(), n_lines - 1);
+  Crates retval(static_cast<size_t>(
+      std::ranges::distance(splitLineIntoWordsFilterEmpty(labels))));
+  for (auto &&line : lines | std::views::take(n_lines - 1)) {
+    for (auto it = std::ranges::begin(line), end = std::ranges::end(line);;
+         ++it) {
+      it = std::find_if(it, end, [](char c) { return c >= 'A' and c <= 'Z'; });
+      if (it == end)
+        break;
+      const auto pos = std::distance(std::ranges::begin(line), it);
+      const auto stack_ind = (pos - 1) / 4;
+      if (retval.size() <= static_cast<size_t>(stack_ind))
+        retval.resize(stack_ind + 1);
+      retval[stack_ind].push_back(*it);
+    }
+  }
+  for (auto &stack : retval)
+    std::ranges::reverse(stack);
+  return retval;
+}
+
+class Stacks {
+public:
+  Stacks(const Crates &crates) {
+    std::ranges::transform(crates, std::back_inserter(roots_),
+                           [&](const auto &stack) {
+                             auto root = CrateRopes::null_node;
+                             for (char crate : stack)
+                               root = ropes_.merge(root,
+                                                   ropes_.makeNode(crate));
+                             return root;
+                           });
   }
 
-  auto getTops() const -> std::string {
+  auto getTops() -> std::string {
     std::string retval;
-    retval.reserve(data_.size());
-    std::ranges::transform(data_, std::back_inserter(retval),
-                           [](const auto &stack) { return stack.back(); });
+    retval.reserve(roots_.size());
+    std::ranges::transform(roots_, std::back_inserter(retval),
+                           [&](auto root) {
+                             return root == CrateRopes::null_node
+                                        ? empty_stack_top
+                                        : ropes_.back(root);
+                           });
     return retval;
   }
   void moveSeq(Move move) {
-    auto &src = data_[move.from];
-    auto &dest = data_[move.to];
-    std::ranges::copy(src | std::views::reverse | std::views::take(move.count),
-                      std::back_inserter(dest));
-    src.erase(std::prev(src.end(), move.count), src.end());
+    const auto block = takeBlock(move);
+    ropes_.reverse(block);
+    roots_[move.to] = ropes_.merge(roots_[move.to], block);
   }
   void moveAll(Move move) {
-    auto &src = data_[move.from];
-    auto &dest = data_[move.to];
-    std::ranges::reverse_copy(src | std::views::reverse |
-                                  std::views::take(move.count),
-                              std::back_inserter(dest));
-    src.erase(std::prev(src.end(), move.count), src.end());
+    const auto block = takeBlock(move);
+    roots_[move.to] = ropes_.merge(roots_[move.to], block);
   }
 
 private:
-  std::vector<std::vector<char>> data_;
+  auto takeBlock(Move move) -> CrateRopes::node_t {
+    auto &src = roots_[move.from];
+    const auto [rest, block] =
+        ropes_.split(src, ropes_.size(src) - static_cast<size_t>(move.count));
+    src = rest;
+    return block;
+  }
+
+  CrateRopes ropes_;
+  std::vector<CrateRopes::node_t> roots_;
 };
 
 auto parseMove(auto &&line) -> Move {
@@ -69,32 +192,125 @@ auto parseMove(auto &&line) -> Move {
   return retval;
 }
 
-void part1(std::string_view data) {
-  auto parts = splitIntoSections(data);
-  auto it = std::ranges::begin(parts);
-  auto stacks = Stacks{*it++};
-  std::ranges::for_each(splitIntoLinesUntilEmpty(*it) |
-                            std::views::transform([](std::string_view line) {
-                              return parseMove(line);
-                            }),
-                        [&stacks](Move m) { stacks.moveSeq(m); });
-  std::cout << stacks.getTops() << '\n';
+auto parseMoves(std::string_view section) -> std::vector<Move> {
+  std::vector<Move> retval;
+  std::ranges::transform(splitIntoLinesUntilEmpty(section),
+                         std::back_inserter(retval),
+                         [](std::string_view line) { return parseMove(line); });
+  return retval;
 }
 
-void part2(std::string_view data) {
-  auto parts = splitIntoSections(data);
-  auto it = std::ranges::begin(parts);
-  auto stacks = Stacks{*it++};
-  std::ranges::for_each(splitIntoLinesUntilEmpty(*it) |
-                            std::views::transform([](std::string_view line) {
-                              return parseMove(line);
-                            }),
-                        [&stacks](Move m) { stacks.moveAll(m); });
-  std::cout << stacks.getTops() << '\n';
+enum struct Crane { OneAtATime, AllAtOnce };
+
+auto simulateTops(const Crates &crates, std::span<const Move> moves,
+                  Crane crane) -> std::string {
+  auto stacks = Stacks{crates};
+  for (Move m : moves)
+    if (crane == Crane::OneAtATime)
+      stacks.moveSeq(m);
+    else
+      stacks.moveAll(m);
+  return stacks.getTops();
+}
+
+// Follows the final top position of every stack backwards through the moves to
+// the crate initially occupying it, in O(stacks * moves) and without moving any
+// crates
+auto traceTops(const Crates &crates, std::span<const Move> moves, Crane crane)
+    -> std::string {
+  std::string retval;
+  retval.reserve(crates.size());
+  for (size_t stack = 0; stack < crates.size(); ++stack) {
+    auto pos = static_cast<int>(stack);
+    int depth = 0; // counted from the top
+    for (const auto &[from, to, count] : moves | std::views::reverse) {
+      if (pos == to) {
+        if (depth < count) {
+          pos = from;
+          if (crane == Crane::OneAtATime)
+            depth = count - 1 - depth;
+        } else
+          depth -= count;
+      } else if (pos == from)
+        depth += count;
+    }
+    const auto &initial = crates[static_cast<size_t>(pos)];
+    const auto height = static_cast<int>(initial.size());
+    retval.push_back(depth < height ? initial[height - 1 - depth]
+                                    : empty_stack_top);
+  }
+  return retval;
 }
 
-int main() {
+enum struct Solver { Simulate, Trace };
+
+void part1(const Crates &crates, std::span<const Move> moves, Solver solver) {
+  std::cout << (solver == Solver::Simulate
+                    ? simulateTops(crates, moves, Crane::OneAtATime)
+                    : traceTops(crates, moves, Crane::OneAtATime))
+            << '\n';
+}
+
+void part2(const Crates &crates, std::span<const Move> moves, Solver solver) {
+  std::cout << (solver == Solver::Simulate
+                    ? simulateTops(crates, moves, Crane::AllAtOnce)
+                    : traceTops(crates, moves, Crane::AllAtOnce))
+            << '\n';
+}
+
+// Compares both solvers on random move sequences, which may empty stacks
+void crossCheck(size_t n_inputs) {
+  std::mt19937 gen{42};
+  const auto randInt = [&](int lo, int hi) {
+    return std::uniform_int_distribution<int>{lo, hi}(gen);
+  };
+  for (size_t input = 0; input < n_inputs; ++input) {
+    Crates crates(static_cast<size_t>(randInt(2, 9)));
+    // Any stack but the first may start out empty
+    for (size_t i = 0; i < crates.size(); ++i) {
+      const auto height = i == 0 or randInt(0, 3) != 0 ? randInt(1, 50) : 0;
+      std::ranges::generate_n(std::back_inserter(crates[i]), height, [&] {
+        return static_cast<char>(randInt('A', 'Z'));
+      });
+    }
+    std::vector<int> heights;
+    std::ranges::transform(
+        crates, std::back_inserter(heights),
+        [](const auto &stack) { return static_cast<int>(stack.size()); });
+    std::vector<Move> moves(static_cast<size_t>(randInt(0, 1000)));
+    const auto n_stacks = static_cast<int>(crates.size());
+    for (auto &move : moves) {
+      do
+        move.from = randInt(0, n_stacks - 1);
+      while (heights[move.from] == 0);
+      move.to = (move.from + randInt(1, n_stacks - 1)) % n_stacks;
+      move.count = randInt(1, heights[move.from]);
+      heights[move.from] -= move.count;
+      heights[move.to] += move.count;
+    }
+    for (auto crane : {Crane::OneAtATime, Crane::AllAtOnce})
+      if (simulateTops(crates, moves, crane) != traceTops(crates, moves, crane))
+        throw std::runtime_error{"solver mismatch on input " +
+                                 std::to_string(input)};
+  }
+  std::cout << "solvers agree on " << n_inputs << " inputs\n";
+}
+
+// Usage: aoc [simulate|trace] < data.txt, or aoc check [num_inputs]
+int main(int argc, char *argv[]) {
+  const auto args = getArgs(argc, argv);
+  if (not args.empty() and args.front() == "check"sv) {
+    crossCheck(args.size() > 1 ? toNumber<size_t>(args[1]) : 1000);
+    return 0;
+  }
+  const auto solver = not args.empty() and args.front() == "trace"sv
+                          ? Solver::Trace
+                          : Solver::Simulate;
   const auto [alloc, data] = getStdinView();
-  part1(data);
-  part2(data);
+  auto parts = splitIntoSections(data);
+  auto it = std::ranges::begin(parts);
+  const auto crates = parseCrates(*it++);
+  const auto moves = parseMoves(*it);
+  part1(crates, moves, solver);
+  part2(crates, moves, solver);
 }
@@ -2,30 +2,163 @@
 
 #include <span>
 
-bool isUnique(std::span<const char> input) {
-  std::array<bool, 256> map{};
-  return std::ranges::none_of(
-      input, [&](char c) { return std::exchange(map[c], true); });
+// Tracks how many times each byte occurs in a sliding window, and how many of
+// those occurrences are repeats, so that every step is O(1)
+class WindowTracker {
+public:
+  WindowTracker(size_t window_size) : window_size_{window_size} {}
+
+  void push(char c) {
+    if (count_[byte(c)]++ != 0)
+      ++n_repeats_;
+    ++n_chars_;
+  }
+  void pop(char c) {
+    if (--count_[byte(c)] != 0)
+      --n_repeats_;
+    --n_chars_;
+  }
+  // Slides the window by one byte, c_out is ignored while it is not yet full
+  void slide(char c_in, char c_out) {
+    push(c_in);
+    if (n_chars_ > window_size_)
+      pop(c_out);
+  }
+  bool isUnique() const { return n_chars_ == window_size_ and n_repeats_ == 0; }
+  size_t windowSize() const { return window_size_; }
+
+private:
+  static auto byte(char c) -> unsigned char {
+    return static_cast<unsigned char>(c);
+  }
+
+  size_t window_size_, n_chars_{}, n_repeats_{};
+  std::array<size_t, 256> count_{};
+};
+
+auto getMarkerInput(std::string_view data) -> std::span<const char> {
+  return std::span{data.substr(0, data.find('\n'))};
 }
 
-size_t firstUniqueAfter(std::string_view input, size_t window_size) {
-  const auto span = std::span{input};
-  for (size_t i = 0; i < span.size() - window_size; ++i)
-    if (isUnique(span.subspan(i, window_size)))
-      return i + window_size;
-  return 0;
+constexpr size_t not_found = std::numeric_limits<size_t>::max();
+
+// For every window size, the position just after the first unique window
+// ending in input[begin, end), or not_found. All window sizes share one pass,
+// which returns early once cancelled() is true
+auto searchChunk(std::span<const char> input, size_t begin, size_t end,
+                 std::span<const size_t> window_sizes, auto &&cancelled)
+    -> std::vector<size_t> {
+  constexpr size_t cancel_check_interval = 1ul << 14;
+  const auto max_window = std::ranges::max(window_sizes);
+  const auto start = begin - std::min(begin, max_window - 1);
+  std::vector<WindowTracker> trackers(window_sizes.begin(), window_sizes.end());
+  std::vector<size_t> retval(window_sizes.size(), not_found);
+  size_t n_found = 0;
+  for (size_t pos = start; pos < end and n_found < trackers.size(); ++pos) {
+    if (pos % cancel_check_interval == 0 and cancelled())
+      break;
+    for (size_t i = 0; auto &tracker : trackers) {
+      if (retval[i] == not_found) {
+        const auto w = tracker.windowSize();
+        tracker.slide(input[pos], pos >= w ? input[pos - w] : char{});
+        if (pos >= begin and tracker.isUnique()) {
+          retval[i] = pos + 1;
+          ++n_found;
+        }
+      }
+      ++i;
+    }
+  }
+  return retval;
+}
+
+void updateMin(std::atomic<size_t> &min, size_t value) {
+  auto current = min.load();
+  while (value < current and not min.compare_exchange_weak(current, value))
+    ;
 }
 
-void part1(std::string_view data) {
-  std::cout << firstUniqueAfter(data, 4) << '\n';
+// Splits the input into chunks searched in parallel, each primed with the
+// window_size - 1 bytes preceding it. Chunks are handed out in order, and a
+// chunk is abandoned as soon as every window size has a hit before it
+auto firstUniqueAfter(std::span<const char> input,
+                      std::span<const size_t> window_sizes)
+    -> std::vector<size_t> {
+  constexpr size_t min_chunk_size = 1ul << 20;
+  const auto n_chunks = std::min(getNumThreads() * 16,
+                                 input.size() / min_chunk_size + 1);
+  const auto chunk_size = (input.size() + n_chunks - 1) / n_chunks;
+  std::vector<std::atomic<size_t>> first(window_sizes.size());
+  for (auto &f : first)
+    f = not_found;
+  parallelFor(n_chunks, [&](size_t chunk) {
+    const auto begin = chunk * chunk_size;
+    const auto end = std::min(begin + chunk_size, input.size());
+    const auto cancelled = [&] {
+      return std::ranges::all_of(first, [&](const auto &f) {
+        return f.load(std::memory_order_relaxed) <= begin;
+      });
+    };
+    if (cancelled())
+      return;
+    const auto found = searchChunk(input, begin, end, window_sizes, cancelled);
+    for (size_t i = 0; i < found.size(); ++i)
+      updateMin(first[i], found[i]);
+  });
+  std::vector<size_t> retval;
+  std::ranges::transform(first, std::back_inserter(retval), [](const auto &f) {
+    return f == not_found ? 0 : f.load();
+  });
+  return retval;
 }
 
-void part2(std::string_view data) {
-  std::cout << firstUniqueAfter(data, 14) << '\n';
+// Reports every marker position (as "window_size position") for input read
+// from stdin in chunks, so it also works on pipes
+void streamAllMarkers(std::span<const size_t> window_sizes) {
+  constexpr size_t chunk_size = 1ul << 20;
+  const auto max_window = std::ranges::max(window_sizes);
+  std::vector<WindowTracker> trackers(window_sizes.begin(), window_sizes.end());
+  size_t stream_pos = 0; // position of the next unseen byte
+  bool done = false;
+  forEachStdinChunk(chunk_size, max_window, [&](std::string_view chunk,
+                                               size_t offset) {
+    for (auto pos = stream_pos - offset; pos < chunk.size() and not done;
+         ++pos, ++stream_pos) {
+      if (chunk[pos] == '\n') {
+        done = true;
+        break;
+      }
+      for (auto &tracker : trackers) {
+        const auto w = tracker.windowSize();
+        tracker.slide(chunk[pos], pos >= w ? chunk[pos - w] : char{});
+        if (tracker.isUnique())
+          std::cout << w << ' ' << stream_pos + 1 << '\n';
+      }
+    }
+  });
 }
 
-int main() {
-  const auto [alloc, data] = getStdinView();
-  part1(data);
-  part2(data);
+// Usage: aoc [stream] [window sizes...] < data.txt, window sizes default to the
+// puzzle's 4 and 14. In stream mode, every marker is reported
+int main(int argc, char *argv[]) {
+  auto args = getArgs(argc, argv);
+  const bool stream = not args.empty() and args.front() == "stream"sv;
+  if (stream)
+    args.erase(args.begin());
+  std::vector<size_t> window_sizes{4, 14};
+  if (not args.empty()) {
+    window_sizes.clear();
+    std::ranges::transform(args, std::back_inserter(window_sizes),
+                           [](auto arg) { return toNumber<size_t>(arg); });
+  }
+  if (std::ranges::find(window_sizes, 0u) != window_sizes.end())
+    throw std::runtime_error{"window sizes must be positive"};
+
+  if (stream)
+    streamAllMarkers(window_sizes);
+  else {
+    const auto [alloc, data] = getStdinView();
+    for (auto marker : firstUniqueAfter(getMarkerInput(data), window_sizes))
+      std::cout << marker << '\n';
+  }
 }
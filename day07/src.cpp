@@ -1,69 +1,120 @@
 #include "../common/common.hpp"
 
+#include <cstdint>
+#include <deque>
 #include <functional>
-#include <map>
+#include <optional>
+#include <set>
+#include <span>
+#include <string>
+#include <unordered_map>
+
+using name_id_t = std::uint32_t;
+
+// Owns a single copy of every distinct name, so that names are hashed and
+// compared byte by byte only once, when they are first interned. Views of the
+// stored names stay valid when the table is moved
+class NameTable {
+public:
+  auto intern(std::string_view name) -> name_id_t {
+    if (const auto it = ids_.find(name); it != ids_.end())
+      return it->second;
+    const auto id = static_cast<name_id_t>(names_.size());
+    const std::string_view stored = storage_.emplace_back(name);
+    names_.push_back(stored);
+    ids_.emplace(stored, id);
+    return id;
+  }
+  auto operator[](name_id_t id) const -> std::string_view {
+    return names_[id];
+  }
+
+private:
+  std::deque<std::string> storage_;
+  std::vector<std::string_view> names_;
+  std::unordered_map<std::string_view, name_id_t> ids_;
+};
 
 struct File {
   std::string_view name;
   size_t size;
 };
 
+// Directory of the tree under construction, in order of creation
 struct Directory {
-  bool isRoot() const { return parent == nullptr; }
-
-  Directory *parent{};
-  size_t size{};
-  std::map<std::string_view, std::unique_ptr<Directory>> children;
+  size_t parent;
+  std::string_view name;
+  std::vector<size_t> children;
   std::vector<File> files;
+  size_t size{}; // only maintained with SizeTracking::on
 };
 
-void visitPostOrder(auto &&visitor, Directory &dir,
-                    std::string_view name = "/"sv)
-  requires std::invocable<decltype(visitor), Directory &, std::string_view>
-{
-  for (auto &[child_name, child_ptr] : dir.children)
-    visitPostOrder(visitor, *child_ptr, child_name);
-  std::invoke(visitor, dir, name);
-}
+constexpr size_t no_parent = std::numeric_limits<size_t>::max();
 
-void visitPostOrder(auto &&visitor, const Directory &dir,
-                    std::string_view name = "/"sv)
-  requires std::invocable<decltype(visitor), const Directory &,
-                          std::string_view>
-{
-  for (const auto &[child_name, child_ptr] : dir.children)
-    visitPostOrder(visitor, *child_ptr, child_name);
-  std::invoke(visitor, dir, "/"sv);
-}
+// Directories stored contiguously in DFS pre-order. The subtree of directory i
+// occupies [i, subtree_end[i]), so its first child (if any) is i + 1 and the
+// next sibling of child c is subtree_end[c]. The files of directory i are
+// files[files_begin[i], files_begin[i + 1])
+struct DirectoryTree {
+  NameTable name_table; // owns the viewed names
+  std::vector<std::string_view> names;
+  std::vector<size_t> parent, subtree_end, size, files_begin;
+  std::vector<File> files;
 
-void visitPreOrder(auto &&visitor, const Directory &dir,
-                   std::string_view name = "/"sv)
-  requires std::invocable<decltype(visitor), const Directory &,
-                          std::string_view>
-{
-  std::invoke(visitor, dir, name);
-  for (const auto &[child_name, child_ptr] : dir.children)
-    visitPreOrder(visitor, *child_ptr, child_name);
-}
+  size_t numDirs() const { return names.size(); }
+  bool isRoot(size_t dir) const { return parent[dir] == no_parent; }
+  auto getFiles(size_t dir) const -> std::span<const File> {
+    return std::span{files}.subspan(files_begin[dir],
+                                    files_begin[dir + 1] - files_begin[dir]);
+  }
+};
 
-size_t getDirectoryFilesSize(const Directory &dir) {
-  return std::transform_reduce(dir.files.begin(), dir.files.end(), 0ul,
-                               std::plus{},
-                               [](const File &f) { return f.size; });
+// Children come after their parent in pre-order, so one reverse sweep
+// accumulates every subtree
+void computeSizes(DirectoryTree &tree) {
+  tree.size.resize(tree.numDirs());
+  for (size_t dir = 0; dir < tree.numDirs(); ++dir) {
+    const auto files = tree.getFiles(dir);
+    tree.size[dir] =
+        std::transform_reduce(files.begin(), files.end(), 0ul, std::plus{},
+                              [](const File &f) { return f.size; });
+  }
+  for (size_t dir = tree.numDirs() - 1; dir > 0; --dir)
+    tree.size[tree.parent[dir]] += tree.size[dir];
 }
 
-size_t getDirectoryChildrenSize(const Directory &dir) {
-  return std::transform_reduce(
-      dir.children.begin(), dir.children.end(), 0ul, std::plus{},
-      [&](const auto &pair) { return pair.second->size; });
-}
+auto flatten(const std::vector<Directory> &dirs) -> DirectoryTree {
+  DirectoryTree tree;
+  for (auto *v : {&tree.parent, &tree.subtree_end, &tree.files_begin})
+    v->reserve(dirs.size() + 1);
+  tree.names.reserve(dirs.size());
 
-void computeSizes(Directory &root) {
-  visitPostOrder(
-      [](Directory &dir, std::string_view) {
-        dir.size = getDirectoryFilesSize(dir) + getDirectoryChildrenSize(dir);
-      },
-      root);
+  // Stack of (directory, index of its flattened parent); subtree ends are
+  // written once the next directory outside the subtree is reached
+  std::vector<std::pair<size_t, size_t>> stack{{0, no_parent}};
+  std::vector<size_t> open_dirs;
+  while (not stack.empty()) {
+    const auto [dir, parent] = stack.back();
+    stack.pop_back();
+    const auto index = tree.numDirs();
+    while (not open_dirs.empty() and open_dirs.back() != parent) {
+      tree.subtree_end[open_dirs.back()] = index;
+      open_dirs.pop_back();
+    }
+    open_dirs.push_back(index);
+    tree.names.push_back(dirs[dir].name);
+    tree.parent.push_back(parent);
+    tree.subtree_end.push_back(index + 1);
+    tree.files_begin.push_back(tree.files.size());
+    std::ranges::copy(dirs[dir].files, std::back_inserter(tree.files));
+    for (auto child : dirs[dir].children | std::views::reverse)
+      stack.emplace_back(child, index);
+  }
+  for (auto dir : open_dirs)
+    tree.subtree_end[dir] = tree.numDirs();
+  tree.files_begin.push_back(tree.files.size());
+  computeSizes(tree);
+  return tree;
 }
 
 enum struct Command { Ls, CdIn, CdOut, CdRoot };
@@ -88,103 +139,219 @@ auto parseCommand(std::string_view line)
     throw std::runtime_error{"invalid command"};
 }
 
-auto parseFS(std::string_view data) -> Directory {
-  auto lines = splitIntoLinesUntilEmpty(data);
-  auto line_it = lines.begin();
-  Directory root{};
-  Directory *wd{};
-
-  const auto makeSubDir = [&](std::string_view name) { // mkdir -p name
-    if (auto in_it = wd->children.find(name); in_it != wd->children.end())
-      return in_it->second.get();
-    auto &new_dir = wd->children[name];
-    new_dir = std::make_unique<Directory>();
-    new_dir->parent = wd;
-    return new_dir.get();
-  };
-  const auto parseLs = [&] {
-    while (line_it != lines.end()) {
-      auto words = splitLineIntoWordsFilterEmpty(*line_it);
-      auto word_it = words.begin();
-      if (*word_it == "$"sv)
-        return;
-      ++line_it;
-      if (*word_it == "dir"sv)
-        makeSubDir(*std::next(word_it));
-      else
-        wd->files.emplace_back(*std::next(word_it), toNumber<size_t>(*word_it));
-    }
-  };
-
-  while (line_it != lines.end()) {
-    const auto [cmd, val] = parseCommand(*line_it++);
-    switch (cmd) {
-    case Command::Ls:
-      parseLs();
-      break;
-    case Command::CdIn:
-      wd = makeSubDir(val);
-      break;
-    case Command::CdOut:
-      wd = wd->parent;
-      break;
-    case Command::CdRoot:
-      wd = std::addressof(root);
+constexpr size_t small_dir_limit = 100'000;
+enum struct SizeTracking { off, on };
+
+// Builds the directory arena from terminal session lines, which can be applied
+// in any number of batches. With SizeTracking::on, adding a file propagates
+// the size delta up the parent chain and keeps the statistics needed by part1
+// and part2 up to date, so they can be queried at any point of the session
+class SessionLog {
+public:
+  SessionLog(SizeTracking tracking = SizeTracking::off) : tracking_{tracking} {
+    dirs_.push_back(Directory{no_parent, names_[names_.intern("/"sv)], {}, {}});
+    if (tracking_ == SizeTracking::on)
+      dirs_by_size_.emplace(0, 0);
+  }
+
+  // Applies the complete lines in data, which is not referenced afterwards
+  void apply(std::string_view data) {
+    for (auto &&line : data | std::views::split("\n"sv))
+      if (const auto line_view = std::string_view{line}; not line_view.empty())
+        applyLine(line_view);
+  }
+
+  auto getDirectories() const -> const std::vector<Directory> & {
+    return dirs_;
+  }
+  // Moves out the names viewed by the directories and files
+  auto extractNames() -> NameTable { return std::move(names_); }
+  size_t getRootSize() const { return dirs_.front().size; }
+  // Sum of the sizes of directories of at most small_dir_limit
+  size_t getSmallDirsSize() const { return small_dirs_size_; }
+  // Smallest directory of at least min_size, as (size, directory index)
+  auto getSmallestDirAtLeast(size_t min_size) const
+      -> std::optional<std::pair<size_t, size_t>> {
+    const auto it = dirs_by_size_.lower_bound({min_size, 0});
+    if (it == dirs_by_size_.end())
+      return std::nullopt;
+    return *it;
+  }
+
+private:
+  void applyLine(std::string_view line) {
+    auto words = splitLineIntoWordsFilterEmpty(line);
+    auto word_it = words.begin();
+    if (*word_it == "$"sv) {
+      const auto [cmd, val] = parseCommand(line);
+      switch (cmd) {
+      case Command::Ls:
+        break;
+      case Command::CdIn:
+        wd_ = makeSubDir(val);
+        break;
+      case Command::CdOut:
+        wd_ = dirs_[wd_].parent;
+        break;
+      case Command::CdRoot:
+        wd_ = 0;
+      }
+    } else if (*word_it == "dir"sv)
+      makeSubDir(*std::next(word_it));
+    else
+      addFile(*std::next(word_it), toNumber<size_t>(*word_it));
+  }
+
+  // Directory entries are looked up by (directory, name id)
+  static auto makeKey(size_t dir, name_id_t name) -> std::uint64_t {
+    return static_cast<std::uint64_t>(dir) << 32 | name;
+  }
+
+  auto makeSubDir(std::string_view name) -> size_t { // mkdir -p name
+    const auto name_id = names_.intern(name);
+    const auto [it, inserted] =
+        subdirs_.try_emplace(makeKey(wd_, name_id), dirs_.size());
+    if (not inserted)
+      return it->second;
+    const auto new_dir = it->second;
+    dirs_[wd_].children.push_back(new_dir);
+    dirs_.push_back(Directory{wd_, names_[name_id], {}, {}});
+    if (tracking_ == SizeTracking::on)
+      dirs_by_size_.emplace(0, new_dir);
+    return new_dir;
+  }
+
+  // Re-listed files replace their previous size
+  void addFile(std::string_view name, size_t size) {
+    auto &files = dirs_[wd_].files;
+    const auto name_id = names_.intern(name);
+    const auto [it, inserted] =
+        file_indices_.try_emplace(makeKey(wd_, name_id), files.size());
+    if (inserted)
+      files.emplace_back(names_[name_id], 0);
+    const auto old_size = std::exchange(files[it->second].size, size);
+    if (tracking_ == SizeTracking::on and size != old_size)
+      propagate(size - old_size);
+  }
+
+  // Adds delta (modulo 2^64, so it may be "negative") to wd_ and its ancestors
+  void propagate(size_t delta) {
+    for (auto dir = wd_; dir != no_parent; dir = dirs_[dir].parent) {
+      auto &size = dirs_[dir].size;
+      dirs_by_size_.erase({size, dir});
+      if (size <= small_dir_limit)
+        small_dirs_size_ -= size;
+      size += delta;
+      dirs_by_size_.emplace(size, dir);
+      if (size <= small_dir_limit)
+        small_dirs_size_ += size;
     }
   }
 
-  computeSizes(root);
-  return root;
+  NameTable names_;
+  std::unordered_map<std::uint64_t, size_t> subdirs_, file_indices_;
+  std::vector<Directory> dirs_;
+  size_t wd_{};
+  SizeTracking tracking_;
+  std::set<std::pair<size_t, size_t>> dirs_by_size_;
+  size_t small_dirs_size_{};
+};
+
+auto parseFS(std::string_view data) -> DirectoryTree {
+  SessionLog log;
+  log.apply(data.substr(0, data.find("\n\n"sv)));
+  auto tree = flatten(log.getDirectories());
+  tree.name_table = log.extractNames();
+  return tree;
 }
 
-void print(const Directory &dir, size_t indent = 0) {
-  if (dir.isRoot())
-    std::cout << "- / (dir, size = " << dir.size << ")\n";
+void print(const DirectoryTree &tree, size_t dir = 0, size_t indent = 0) {
+  if (tree.isRoot(dir))
+    std::cout << "- / (dir, size = " << tree.size[dir] << ")\n";
   indent += 2;
-  for (const auto &[name, child_ptr] : dir.children) {
+  for (auto child = dir + 1; child < tree.subtree_end[dir];
+       child = tree.subtree_end[child]) {
     for (size_t i = 0; i < indent; ++i)
       std::cout << ' ';
-    std::cout << "- " << name << " (dir, size = " << child_ptr->size << ")\n";
-    print(*child_ptr, indent);
+    std::cout << "- " << tree.names[child]
+              << " (dir, size = " << tree.size[child] << ")\n";
+    print(tree, child, indent);
   }
-  for (const File &f : dir.files) {
+  for (const File &f : tree.getFiles(dir)) {
     for (size_t i = 0; i < indent; ++i)
       std::cout << ' ';
     std::cout << "- " << f.name << " (file, size = " << f.size << ")\n";
   }
 }
 
-void part1(const Directory &root) {
+void part1(const DirectoryTree &tree) {
   size_t sum{};
-  visitPreOrder(
-      [&](const Directory &dir, std::string_view) {
-        if (dir.size <= 100'000)
-          sum += dir.size;
-      },
-      root);
+  for (auto size : tree.size)
+    if (size <= small_dir_limit)
+      sum += size;
   std::cout << sum << '\n';
 }
 
-void part2(const Directory &root) {
-  constexpr size_t total_space = 70'000'000, space_needed = 30'000'000;
-  const size_t free_space = total_space - root.size;
+constexpr size_t total_space = 70'000'000, space_needed = 30'000'000;
+
+void part2(const DirectoryTree &tree) {
+  const size_t free_space = total_space - tree.size.front();
   const size_t space_to_free = space_needed - free_space;
   size_t answer = -1;
   std::string_view answer_name{};
-  visitPreOrder(
-      [&](const Directory &dir, std::string_view name) {
-        if (dir.size >= space_to_free and dir.size < answer) {
-          answer = dir.size;
-          answer_name = name;
-        }
-      },
-      root);
+  for (size_t dir = 0; dir < tree.numDirs(); ++dir)
+    if (tree.size[dir] >= space_to_free and tree.size[dir] < answer) {
+      answer = tree.size[dir];
+      answer_name = tree.names[dir];
+    }
   std::cout << answer << " (directory " << answer_name << ")\n";
 }
 
-int main() {
-  const auto [alloc, data] = getStdinView();
+// Answers both parts from the maintained statistics
+void printStats(const SessionLog &log) {
+  std::cout << log.getSmallDirsSize() << '\n';
+  const size_t free_space = total_space - log.getRootSize();
+  const size_t space_to_free = space_needed - free_space;
+  if (const auto dir = log.getSmallestDirAtLeast(space_to_free); dir)
+    std::cout << dir->first << " (directory "
+              << log.getDirectories()[dir->second].name << ")\n";
+  else
+    std::cout << "none\n";
+}
+
+// Applies session lines as they arrive on stdin (e.g. from `tail -f`) and
+// prints the updated answers after every batch
+void tailSession() {
+  constexpr size_t chunk_size = 1ul << 16;
+  SessionLog log{SizeTracking::on};
+  std::string pending;
+  forEachStdinChunk(chunk_size, 0, [&](std::string_view chunk, size_t) {
+    const auto last_endl = chunk.rfind('\n');
+    if (last_endl == std::string_view::npos) {
+      pending += chunk;
+      return;
+    }
+    pending += chunk.substr(0, last_endl + 1);
+    log.apply(pending);
+    pending = chunk.substr(last_endl + 1);
+    printStats(log);
+  });
+  if (not pending.empty()) {
+    log.apply(pending);
+    printStats(log);
+  }
+}
+
+// Usage: aoc [tail] < session.txt
+int main(int argc, char *argv[]) {
+  if (const auto args = getArgs(argc, argv);
+      not args.empty() and args.front() == "tail"sv) {
+    tailSession();
+    return 0;
+  }
+  auto [alloc, data] = getStdinView();
   const auto fs = parseFS(data);
+  alloc.reset(); // names are interned, the input can be released
   // print(fs); std::puts("");
   part1(fs);
   part2(fs);
@@ -1,5 +1,9 @@
 #include "../common/common.hpp"
 
+#include <cstdint>
+#include <random>
+#include <span>
+
 auto getHeights(std::string_view data) {
   std::vector<char> heights;
   size_t row_size{};
@@ -27,9 +31,10 @@ void computeRowThresholds(std::span<const char> row,
   std::ranges::transform(forward_max, backward_max, out_it, min_val);
 }
 
-// This is a clunky workaround since we don't yet have views::strided or mdspan
-void computeColThresholds(auto col_begin, std::span<char> forward_max,
-                          auto out_begin, size_t row_size, size_t n_rows) {
+// Reference column pass, walking each column with stride row_size
+void computeColThresholdsStrided(auto col_begin, std::span<char> forward_max,
+                                 auto out_begin, size_t row_size,
+                                 size_t n_rows) {
   char threshold = -1;
   for (size_t row = 0; row < n_rows; ++row) {
     forward_max[row] = threshold;
@@ -44,29 +49,87 @@ void computeColThresholds(auto col_begin, std::span<char> forward_max,
   }
 }
 
-void part1(const std::vector<char> &heights, size_t row_size) {
-  std::vector<char> visibility_threshold(heights.size()), helpers(2 * row_size);
-  const auto forward_max = std::span{helpers}.subspan(0, row_size);
-  const auto backward_max = std::span{helpers}.subspan(row_size);
-  size_t n_rows{};
-  for (size_t row_offs = 0; row_offs < heights.size(); row_offs += row_size) {
-    const auto row = std::span{heights}.subspan(row_offs, row_size);
-    computeRowThresholds(row, forward_max, backward_max,
-                         std::next(visibility_threshold.begin(), row_offs));
-    ++n_rows;
-  }
-  for (size_t col = 0; col < row_size; ++col) {
-    computeColThresholds(std::next(heights.cbegin(), col), forward_max,
-                         std::next(visibility_threshold.begin(), col), row_size,
-                         n_rows);
+// Folds the max height above and below every tree in columns [col_begin,
+// col_end) into out. Columns are processed in tiles of adjacent columns, so
+// that every row slice loaded serves the whole tile while the running maxima
+// stay in L1, and the inner loops are element-wise max/min which get vectorized
+void computeColThresholdsTiled(std::span<const char> heights,
+                               std::span<char> out, size_t row_size,
+                               size_t col_begin, size_t col_end) {
+  constexpr size_t tile_width = 4096;
+  const size_t n_rows = heights.size() / row_size;
+  std::array<char, tile_width> running_max;
+  for (size_t tile = col_begin; tile < col_end; tile += tile_width) {
+    const auto width = std::min(tile_width, col_end - tile);
+    const auto applyRow = [&](size_t row) {
+      const auto heights_row = heights.subspan(row * row_size + tile, width);
+      const auto out_row = out.subspan(row * row_size + tile, width);
+      for (size_t c = 0; c < width; ++c) {
+        out_row[c] = std::min(out_row[c], running_max[c]);
+        running_max[c] = std::max(running_max[c], heights_row[c]);
+      }
+    };
+    running_max.fill(-1);
+    for (size_t row = 0; row < n_rows; ++row)
+      applyRow(row);
+    running_max.fill(-1);
+    for (size_t row = n_rows - 1; row < n_rows; --row)
+      applyRow(row);
   }
+}
+
+enum struct ColumnPass { Strided, Tiled };
+
+// Minimal number of columns per task, so that tasks do not share cache lines
+constexpr size_t min_cols_per_task = 64;
+
+// The row, column and counting phases each run in parallel, separated by the
+// join at the end of every parallelFor
+size_t countVisible(const std::vector<char> &heights, size_t row_size,
+                    ColumnPass col_pass = ColumnPass::Tiled) {
+  const size_t n_rows = heights.size() / row_size;
+  std::vector<char> visibility_threshold(heights.size());
+  parallelForBlocks(n_rows, 1, [&](size_t row_begin, size_t row_end) {
+    std::vector<char> helpers(2 * row_size);
+    const auto forward_max = std::span{helpers}.subspan(0, row_size);
+    const auto backward_max = std::span{helpers}.subspan(row_size);
+    for (size_t r = row_begin; r < row_end; ++r) {
+      const auto row_offs = r * row_size;
+      const auto row = std::span{heights}.subspan(row_offs, row_size);
+      computeRowThresholds(row, forward_max, backward_max,
+                           std::next(visibility_threshold.begin(), row_offs));
+    }
+  });
+  parallelForBlocks(
+      row_size, min_cols_per_task, [&](size_t col_begin, size_t col_end) {
+        if (col_pass == ColumnPass::Tiled) {
+          computeColThresholdsTiled(heights, visibility_threshold, row_size,
+                                    col_begin, col_end);
+          return;
+        }
+        std::vector<char> forward_max(n_rows);
+        for (size_t col = col_begin; col < col_end; ++col)
+          computeColThresholdsStrided(
+              std::next(heights.cbegin(), col), forward_max,
+              std::next(visibility_threshold.begin(), col), row_size, n_rows);
+      });
 
-  const size_t n_visible_trees = std::ranges::count_if(
-      std::views::iota(0u) | std::views::take(heights.size()),
-      [&](auto index) { return heights[index] > visibility_threshold[index]; });
-  std::cout << n_visible_trees << '\n';
+  std::vector<size_t> block_counts(4 * getNumThreads());
+  std::atomic<size_t> next_block{};
+  parallelForBlocks(heights.size(), 1ul << 16, [&](size_t begin, size_t end) {
+    size_t count{};
+    for (auto i = begin; i < end; ++i)
+      count += static_cast<size_t>(heights[i] > visibility_threshold[i]);
+    block_counts[next_block++] = count;
+  });
+  return std::reduce(block_counts.begin(), block_counts.end());
 }
 
+void part1(const std::vector<char> &heights, size_t row_size) {
+  std::cout << countVisible(heights, row_size) << '\n';
+}
+
+// Reference implementation walking rays from every tree, O(n * (w + h))
 size_t computeDirScore(const std::vector<char> &heights, size_t pos,
                        ptrdiff_t stride, size_t max_steps) {
   const auto my_height = heights[pos];
@@ -88,17 +151,195 @@ size_t computeViewScore(const std::vector<char> &heights, size_t row_size,
   return left * right * top * bot;
 }
 
-void part2(const std::vector<char> &heights, size_t row_size) {
+size_t maxScenicScoreRayWalk(const std::vector<char> &heights,
+                             size_t row_size) {
   const size_t n_rows = heights.size() / row_size;
   size_t max_score{};
   for (size_t r = 0; r < n_rows; ++r)
     for (size_t c = 0; c < row_size; ++c)
       max_score = std::max(max_score,
                            computeViewScore(heights, row_size, n_rows, r, c));
-  std::cout << max_score << '\n';
+  return max_score;
+}
+
+// Heights are 0-9, so the viewing distance from a tree is the distance to the
+// closest tree at least as tall. The blockers table holds, for every height,
+// the position of that tree, so a lookup is O(1) and an update is a fixed-size
+// (vectorizable) select, making every sweep linear
+constexpr size_t n_heights = 16; // 10 heights, padded for vectorization
+using dist_t = std::uint16_t;
+using blockers_t = std::array<dist_t, n_heights>;
+
+// update_masks[height][h] selects the entries a tree of given height blocks
+constexpr auto update_masks = std::invoke([] {
+  std::array<blockers_t, n_heights> retval{};
+  for (size_t height = 0; height < n_heights; ++height)
+    for (size_t h = 0; h <= height; ++h)
+      retval[height][h] = std::numeric_limits<dist_t>::max();
+  return retval;
+});
+
+void updateBlockers(blockers_t &blockers, size_t pos, char height) {
+  // Work on copies, so the compiler needs no aliasing checks to vectorize
+  const auto mask = update_masks[height];
+  const auto pos_val = static_cast<dist_t>(pos);
+  auto updated = blockers;
+  for (size_t h = 0; h < n_heights; ++h)
+    updated[h] = static_cast<dist_t>((pos_val & mask[h]) |
+                                     (updated[h] & ~mask[h]));
+  blockers = updated;
+}
+
+dist_t distanceBack(blockers_t &blockers, size_t pos, char height) {
+  const auto retval = static_cast<dist_t>(pos - blockers[height]);
+  updateBlockers(blockers, pos, height);
+  return retval;
 }
 
-int main() {
+dist_t distanceFwd(blockers_t &blockers, size_t pos, char height) {
+  const auto retval = static_cast<dist_t>(blockers[height] - pos);
+  updateBlockers(blockers, pos, height);
+  return retval;
+}
+
+void computeRowDistances(std::span<const char> row, std::span<dist_t> left,
+                         std::span<dist_t> right) {
+  blockers_t blockers{};
+  for (size_t c = 0; c < row.size(); ++c)
+    left[c] = distanceBack(blockers, c, row[c]);
+  blockers.fill(static_cast<dist_t>(row.size() - 1));
+  for (size_t c = row.size() - 1; c < row.size(); --c)
+    right[c] = distanceFwd(blockers, c, row[c]);
+}
+
+// Four linear sweeps, run in parallel over horizontal bands of rows. A band
+// needs the column blockers passed on by all rows above and below it, so first
+// each band computes the blockers it passes on (from an empty state), which are
+// then combined across bands. With those, every band runs its sweeps
+// independently: downwards storing the distance up, then upwards computing the
+// distance down and, row by row, left and right, fused with the max
+size_t maxScenicScore(const std::vector<char> &heights, size_t row_size) {
+  const size_t n_rows = heights.size() / row_size;
+  if (std::max(n_rows, row_size) > std::numeric_limits<dist_t>::max())
+    throw std::runtime_error{"grid too large"};
+  const auto n_threads = getNumThreads();
+  const auto n_bands = std::min(n_rows, n_threads > 1 ? 2 * n_threads : 1);
+  const auto bandBegin = [&](size_t band) { return band * n_rows / n_bands; };
+
+  // Column blockers entering each band from above and from below
+  const auto no_blocker_down = std::invoke([&] {
+    blockers_t retval;
+    retval.fill(static_cast<dist_t>(n_rows - 1));
+    return retval;
+  });
+  std::vector<std::vector<blockers_t>> up_in(n_bands), down_in(n_bands);
+  parallelFor(n_bands, [&](size_t band) {
+    up_in[band].resize(row_size);
+    down_in[band].assign(row_size, no_blocker_down);
+  });
+  if (n_bands > 1) {
+    const auto sweepRow = [&](std::vector<blockers_t> &col_blockers,
+                              size_t r) {
+      for (size_t c = 0; c < row_size; ++c)
+        updateBlockers(col_blockers[c], r, heights[r * row_size + c]);
+    };
+    parallelFor(n_bands, [&](size_t band) {
+      if (band + 1 < n_bands)
+        for (auto r = bandBegin(band); r < bandBegin(band + 1); ++r)
+          sweepRow(up_in[band + 1], r);
+      if (band > 0)
+        for (auto r = bandBegin(band + 1) - 1; r >= bandBegin(band); --r)
+          sweepRow(down_in[band - 1], r);
+    });
+    // Blockers from later rows going down (earlier going up) take precedence
+    for (size_t band = 2; band < n_bands; ++band)
+      for (size_t c = 0; c < row_size; ++c)
+        std::ranges::transform(up_in[band][c], up_in[band - 1][c],
+                               up_in[band][c].begin(), max_val);
+    for (size_t band = n_bands - 2; band-- > 0;)
+      for (size_t c = 0; c < row_size; ++c)
+        std::ranges::transform(down_in[band][c], down_in[band + 1][c],
+                               down_in[band][c].begin(), min_val);
+  }
+
+  std::vector<size_t> band_max(n_bands);
+  parallelFor(n_bands, [&](size_t band) {
+    const auto row_begin = bandBegin(band), row_end = bandBegin(band + 1);
+    auto &col_blockers = up_in[band];
+    std::vector<dist_t> up((row_end - row_begin) * row_size);
+    for (auto r = row_begin; r < row_end; ++r)
+      for (size_t c = 0; c < row_size; ++c)
+        up[(r - row_begin) * row_size + c] =
+            distanceBack(col_blockers[c], r, heights[r * row_size + c]);
+
+    col_blockers = std::move(down_in[band]);
+    std::vector<dist_t> left(row_size), right(row_size);
+    size_t max_score{};
+    for (auto r = row_end - 1; r >= row_begin and r < row_end; --r) {
+      const auto row = std::span{heights}.subspan(r * row_size, row_size);
+      computeRowDistances(row, left, right);
+      for (size_t c = 0; c < row_size; ++c) {
+        const size_t down = distanceFwd(col_blockers[c], r, row[c]);
+        max_score =
+            std::max(max_score, size_t{left[c]} * right[c] *
+                                    up[(r - row_begin) * row_size + c] * down);
+      }
+    }
+    band_max[band] = max_score;
+  });
+  return std::ranges::max(band_max);
+}
+
+void part2(const std::vector<char> &heights, size_t row_size) {
+  std::cout << maxScenicScore(heights, row_size) << '\n';
+}
+
+// Times the linear sweeps on random n x n grids, and compares them against the
+// ray walks where those finish in reasonable time. Heights are skewed towards
+// 0 so that lines of sight are long, as in real height maps
+void benchmark(std::span<const std::string_view> sizes) {
+  std::mt19937 gen{42};
+  std::exponential_distribution<> height_dist{.35};
+  for (auto size_str : sizes) {
+    const auto n = toNumber<size_t>(size_str);
+    std::vector<char> heights(n * n);
+    std::ranges::generate(heights, [&] {
+      return static_cast<char>(std::min(height_dist(gen), 9.));
+    });
+    size_t n_visible{}, ref_n_visible{};
+    const auto vis_time =
+        measureSeconds([&] { n_visible = countVisible(heights, n); });
+    const auto ref_vis_time = measureSeconds([&] {
+      ref_n_visible = countVisible(heights, n, ColumnPass::Strided);
+    });
+    std::cout << n << 'x' << n << " visibility: " << vis_time
+              << " s (strided columns " << ref_vis_time << " s"
+              << (n_visible == ref_n_visible ? "" : ", MISMATCH") << ")\n";
+
+    size_t score{};
+    const auto time =
+        measureSeconds([&] { score = maxScenicScore(heights, n); });
+    std::cout << n << 'x' << n << " scenic score: " << time << " s, "
+              << static_cast<double>(n * n) / time << " trees/s";
+    if (n <= 2000) {
+      size_t ref_score{};
+      const auto ref_time = measureSeconds(
+          [&] { ref_score = maxScenicScoreRayWalk(heights, n); });
+      std::cout << " (ray walk " << ref_time << " s"
+                << (ref_score == score ? "" : ", MISMATCH") << ')';
+    }
+    std::cout << '\n';
+  }
+}
+
+// Usage: aoc < data.txt, or aoc bench [grid sizes...]
+int main(int argc, char *argv[]) {
+  if (const auto args = getArgs(argc, argv);
+      not args.empty() and args.front() == "bench"sv) {
+    const auto sizes = std::array{"1000"sv, "4000"sv, "10000"sv};
+    benchmark(args.size() > 1 ? std::span{args}.subspan(1) : sizes);
+    return 0;
+  }
   const auto [alloc, data] = getStdinView();
   const auto [heights, row_size] = getHeights(data);
   part1(heights, row_size);
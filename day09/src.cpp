@@ -1,6 +1,9 @@
 #include "../common/common.hpp"
 
-#include <unordered_set>
+#include <bit>
+#include <cstdint>
+#include <deque>
+#include <span>
 
 auto parseMoves(std::string_view data) {
   return splitIntoLinesUntilEmpty(data) |
@@ -27,20 +30,143 @@ auto parseMoves(std::string_view data) {
          });
 }
 
+// Set of visited positions, stored as a dense bitmap of 64x64 tiles. Tiles are
+// allocated when first touched, and the grid of tiles grows in every direction
+// on demand, so an insert is a lookup in the tile grid plus a shift-and-OR
+class VisitedBitmap {
+public:
+  using pos_t = std::array<ptrdiff_t, 2>;
+
+  void insert(pos_t pos) {
+    const auto [x, y] = pos;
+    getTile(x >> tile_shift, y >> tile_shift)[y & tile_mask] |=
+        std::uint64_t{1} << (x & tile_mask);
+  }
+  // Inserts start, start + step, ..., start + (count - 1) * step
+  void insertSegment(pos_t start, pos_t step, size_t count) {
+    const auto [x0, y] = start;
+    const auto [dx, dy] = step;
+    if (dy != 0 or std::abs(dx) != 1) {
+      for (ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(count); ++i)
+        insert({x0 + i * dx, y + i * dy});
+      return;
+    }
+    // Horizontal segments are set a word at a time
+    const auto x1 = x0 + dx * (static_cast<ptrdiff_t>(count) - 1);
+    const auto x_end = std::max(x0, x1) + 1;
+    for (auto x = std::min(x0, x1); count > 0 and x < x_end;) {
+      const auto word_end = std::min(x_end, (x | tile_mask) + 1);
+      const auto n_bits = word_end - x;
+      const auto bits = n_bits == tile_size
+                            ? ~std::uint64_t{}
+                            : (std::uint64_t{1} << n_bits) - 1;
+      getTile(x >> tile_shift, y >> tile_shift)[y & tile_mask] |=
+          bits << (x & tile_mask);
+      x = word_end;
+    }
+  }
+  size_t count() const {
+    size_t retval{};
+    for (const auto &tile : tiles_)
+      for (auto row : tile)
+        retval += static_cast<size_t>(std::popcount(row));
+    return retval;
+  }
+
+private:
+  static constexpr ptrdiff_t tile_shift = 6, tile_size = 1 << tile_shift,
+                             tile_mask = tile_size - 1;
+  using tile_t = std::array<std::uint64_t, tile_size>;
+  static constexpr std::uint32_t no_tile = 0;
+
+  auto getTile(ptrdiff_t tx, ptrdiff_t ty) -> tile_t & {
+    if (tx == last_tx_ and ty == last_ty_)
+      return tiles_[last_tile_];
+    if (tx < tx0_ or tx >= tx0_ + width_ or ty < ty0_ or ty >= ty0_ + height_)
+      growGrid(tx, ty);
+    auto &index = grid_[(ty - ty0_) * width_ + (tx - tx0_)];
+    if (index == no_tile) {
+      index = static_cast<std::uint32_t>(tiles_.size());
+      tiles_.emplace_back();
+    }
+    last_tx_ = tx;
+    last_ty_ = ty;
+    last_tile_ = index;
+    return tiles_[index];
+  }
+
+  // At least doubles the grid extent towards (tx, ty)
+  void growGrid(ptrdiff_t tx, ptrdiff_t ty) {
+    auto new_tx0 = tx0_, new_ty0 = ty0_, new_width = width_,
+         new_height = height_;
+    const auto grow = [](ptrdiff_t t, ptrdiff_t &t0, ptrdiff_t &extent) {
+      if (t < t0) {
+        const auto new_t0 = std::min(t, t0 - std::max(extent, ptrdiff_t{1}));
+        extent += t0 - new_t0;
+        t0 = new_t0;
+      } else if (t >= t0 + extent)
+        extent = std::max(t - t0 + 1, 2 * extent);
+    };
+    grow(tx, new_tx0, new_width);
+    grow(ty, new_ty0, new_height);
+    std::vector<std::uint32_t> new_grid(
+        static_cast<size_t>(new_width * new_height), no_tile);
+    for (ptrdiff_t y = 0; y < height_; ++y)
+      std::ranges::copy(
+          std::span{grid_}.subspan(static_cast<size_t>(y * width_),
+                                   static_cast<size_t>(width_)),
+          std::next(new_grid.begin(),
+                    (y + ty0_ - new_ty0) * new_width + (tx0_ - new_tx0)));
+    grid_ = std::move(new_grid);
+    tx0_ = new_tx0;
+    ty0_ = new_ty0;
+    width_ = new_width;
+    height_ = new_height;
+  }
+
+  std::deque<tile_t> tiles_{tile_t{}}; // tiles_[no_tile] is unused
+  std::vector<std::uint32_t> grid_;    // indices into tiles_
+  ptrdiff_t tx0_{}, ty0_{}, width_{}, height_{};
+  ptrdiff_t last_tx_{std::numeric_limits<ptrdiff_t>::max()}, last_ty_{};
+  std::uint32_t last_tile_{};
+};
+
 ptrdiff_t sgn(ptrdiff_t val) { return (0 < val) - (val < 0); }
 
-template <size_t num_knots = 2>
-  requires(num_knots > 0)
+// Rope of a runtime number of knots. Knot k follows the same path as the tail
+// of a rope of k + 1 knots, so the positions visited by every knot are tracked
+// to answer all rope lengths from one simulation
 class Chain {
 public:
   using pos_t = std::array<ptrdiff_t, 2>;
 
-  void moveHead(pos_t move) {
-    pos_.front().front() += move.front();
-    pos_.front().back() += move.back();
-    updateRope();
+  Chain(size_t num_knots) : pos_(num_knots), hist_(num_knots) {
+    if (num_knots == 0)
+      throw std::runtime_error{"a rope needs at least one knot"};
+    for (auto &hist : hist_)
+      hist.insert({0, 0});
+  }
+
+  // Moves the head by steps unit moves. Once the rope is stretched straight
+  // behind the head along the move, every knot just follows the head, so the
+  // remaining steps are applied at once and the knots' paths inserted as lines
+  void moveHead(pos_t move, size_t steps = 1) {
+    for (; steps > 0; --steps) {
+      if (isStretchedAlong(move)) {
+        fastForward(move, steps);
+        return;
+      }
+      pos_.front().front() += move.front();
+      pos_.front().back() += move.back();
+      hist_.front().insert(pos_.front());
+      updateRope();
+    }
+  }
+  // Number of positions visited by the tail of a rope of num_knots knots
+  size_t getNumTailPos(size_t num_knots) const {
+    return hist_[num_knots - 1].count();
   }
-  size_t getNumTailPos() const { return tail_hist_.size(); }
+  size_t getNumKnots() const { return pos_.size(); }
 
 private:
   static pos_t getDiff(pos_t lead, pos_t follow) {
@@ -48,50 +174,61 @@ private:
     std::ranges::transform(lead, follow, retval.begin(), std::minus{});
     return retval;
   }
-  static void updateFollow(pos_t lead, pos_t &follow) {
+  // Returns whether follow moved
+  static bool updateFollow(pos_t lead, pos_t &follow) {
     auto &[tx, ty] = follow;
     const auto [dx, dy] = getDiff(lead, follow);
     if (std::abs(dx) == 2 or std::abs(dy) == 2) {
       tx += sgn(dx);
       ty += sgn(dy);
+      return true;
+    }
+    return false;
+  }
+  bool isStretchedAlong(pos_t move) const {
+    for (size_t k = 1; k < pos_.size(); ++k) {
+      const auto [dx, dy] = getDiff(pos_[k - 1], pos_[k]);
+      if (dx != move.front() or dy != move.back())
+        return false;
     }
+    return true;
   }
-  void saveTailPos() { tail_hist_.insert(pos_.back()); }
+  void fastForward(pos_t move, size_t steps) {
+    const auto n = static_cast<ptrdiff_t>(steps);
+    for (size_t k = 0; k < pos_.size(); ++k) {
+      auto &[x, y] = pos_[k];
+      hist_[k].insertSegment({x + move.front(), y + move.back()}, move, steps);
+      x += n * move.front();
+      y += n * move.back();
+    }
+  }
+  // Once a knot stays put, so do all the knots behind it
   void updateRope() {
-    for (auto it :
-         std::views::iota(pos_.begin()) | std::views::take(pos_.size() - 1))
-      updateFollow(*it, *std::next(it));
-    saveTailPos();
+    for (size_t k = 1; k < pos_.size(); ++k) {
+      if (not updateFollow(pos_[k - 1], pos_[k]))
+        return;
+      hist_[k].insert(pos_[k]);
+    }
   }
 
-  using hash_t = decltype([](pos_t key) {
-    std::hash<ptrdiff_t> hash;
-    return hash(key.front()) ^ hash(key.back());
-  });
-
-  std::array<pos_t, num_knots> pos_{};
-  std::unordered_set<pos_t, hash_t> tail_hist_;
+  std::vector<pos_t> pos_;
+  std::vector<VisitedBitmap> hist_; // positions visited by each knot
 };
 
-void part1(auto &&moves) {
-  Chain<2> chain;
-  for (const auto &[move, steps] : moves)
-    for (size_t i = 0; i < steps; ++i)
-      chain.moveHead(move);
-  std::cout << chain.getNumTailPos() << '\n';
-}
-
-void part2(auto &&moves) {
-  Chain<10> chain;
-  for (const auto &[move, steps] : moves)
-    for (size_t i = 0; i < steps; ++i)
-      chain.moveHead(move);
-  std::cout << chain.getNumTailPos() << '\n';
-}
-
-int main() {
+// Usage: aoc [max_num_knots] < data.txt. Without an argument, prints the
+// answers for ropes of 2 and 10 knots, otherwise for every length 2..max
+int main(int argc, char *argv[]) {
+  const auto args = getArgs(argc, argv);
+  const auto max_num_knots = args.empty() ? 10 : toNumber<size_t>(args[0]);
   const auto [alloc, data] = getStdinView();
-  auto moves_view = parseMoves(data);
-  part1(moves_view);
-  part2(moves_view);
+  Chain chain{max_num_knots};
+  for (const auto &[move, steps] : parseMoves(data))
+    chain.moveHead(move, steps);
+  if (args.empty()) {
+    std::cout << chain.getNumTailPos(2) << '\n';
+    std::cout << chain.getNumTailPos(10) << '\n';
+  } else
+    for (size_t num_knots = 2; num_knots <= max_num_knots; ++num_knots)
+      std::cout << num_knots << " knots: " << chain.getNumTailPos(num_knots)
+                << '\n';
 }
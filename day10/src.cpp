@@ -1,75 +1,145 @@
 #include "../common/common.hpp"
 
-class CPU {
-  enum struct State : short { Idle, Adding };
+#include <bit>
+#include <cstdint>
+#include <span>
 
+// Program decoded once into compact bytecode
+struct Instr {
+  enum struct Op : std::uint8_t { Noop, Addx };
+  Op op;
+  std::int16_t val;
+};
+
+auto decode(std::string_view data) -> std::vector<Instr> {
+  std::vector<Instr> retval;
+  for (std::string_view line : splitIntoLinesUntilEmpty(data)) {
+    if (line.starts_with("noop"sv))
+      retval.push_back({Instr::Op::Noop, 0});
+    else if (line.starts_with("addx "sv))
+      retval.push_back(
+          {Instr::Op::Addx, toNumber<std::int16_t>(line.substr(5))});
+    else
+      throw std::runtime_error{"invalid instruction"};
+  }
+  return retval;
+}
+
+// Value of the X register during every cycle of the program (a prefix sum over
+// the addx operands), so that any cycle can be looked up in O(1)
+class RegisterTimeline {
 public:
-  CPU(std::string_view instr) : instrctions_{instr} {}
-  ptrdiff_t getRegister() const { return reg_; }
-  void tick() {
-    if (state_ == State::Idle)
-      incInstrPtr();
-    else {
-      --counter_;
-      if (counter_ == 0) {
-        reg_ += val_;
-        state_ = State::Idle;
-        incInstrPtr();
+  RegisterTimeline(std::span<const Instr> program) {
+    ptrdiff_t reg = 1;
+    x_during_.push_back(reg); // cycles are numbered from 1
+    for (const auto &[op, val] : program) {
+      x_during_.push_back(reg);
+      if (op == Instr::Op::Addx) {
+        x_during_.push_back(reg);
+        reg += val;
       }
     }
   }
-
-private:
-  auto getNextInstr() -> std::string_view {
-    const auto next_endl = instrctions_.find_first_of('\n');
-    if (instrctions_.size() < next_endl + 1u)
+  ptrdiff_t during(size_t cycle) const {
+    if (cycle == 0 or cycle > numCycles())
       throw std::runtime_error{"terminated"};
-    auto retval = instrctions_.substr(0, next_endl);
-    instrctions_.remove_prefix(next_endl + 1u);
-    return retval;
+    return x_during_[cycle];
   }
-  void incInstrPtr() {
-    auto instr = splitLineIntoWordsFilterEmpty(getNextInstr());
-    auto it = instr.begin();
-    if (*it++ == "addx") {
-      state_ = State::Adding;
-      val_ = toNumber<short>(*it);
-      counter_ = 2;
-    }
+  // X during the n_cycles cycles starting at first_cycle
+  auto during(size_t first_cycle, size_t n_cycles) const
+      -> std::span<const ptrdiff_t> {
+    if (first_cycle == 0 or first_cycle + n_cycles - 1 > numCycles())
+      throw std::runtime_error{"terminated"};
+    return std::span{x_during_}.subspan(first_cycle, n_cycles);
   }
+  size_t numCycles() const { return x_during_.size() - 1; }
 
-  std::string_view instrctions_;
-  ptrdiff_t reg_{1};
-  State state_{State::Idle};
-  short counter_{}, val_{};
+private:
+  std::vector<ptrdiff_t> x_during_;
 };
 
-void part1(std::string_view data) {
-  CPU cpu{data};
-  constexpr auto obs_its = std::array{20, 60, 100, 140, 180, 220};
-  ptrdiff_t sig_str = 0, tick = 0;
-  for (auto obs_it : obs_its) {
-    for (; tick != obs_it; ++tick)
-      cpu.tick();
-    sig_str += tick * cpu.getRegister();
-  }
-  std::cout << sig_str << '\n';
+ptrdiff_t sumSignalStrengths(const RegisterTimeline &timeline,
+                             std::span<const size_t> cycles) {
+  ptrdiff_t sig_str = 0;
+  for (auto cycle : cycles)
+    sig_str += static_cast<ptrdiff_t>(cycle) * timeline.during(cycle);
+  return sig_str;
 }
 
-void part2(std::string_view data) {
-  CPU cpu{data};
-  const ptrdiff_t width = 40, height = 6;
-  for (ptrdiff_t h = 0; h < height; ++h) {
-    for (ptrdiff_t w = 0; w < width; ++w) {
-      cpu.tick();
-      std::cout << (std::abs(cpu.getRegister() - w) <= 1 ? '#' : '.');
+void part1(const RegisterTimeline &timeline) {
+  constexpr auto obs_its = std::array<size_t, 6>{20, 60, 100, 140, 180, 220};
+  std::cout << sumSignalStrengths(timeline, obs_its) << '\n';
+}
+
+constexpr size_t max_crt_width = 64;
+
+// Pixels lit by the 3 pixel wide sprite centered on x
+auto spriteMask(ptrdiff_t x) -> std::uint64_t {
+  if (x < -1 or x > static_cast<ptrdiff_t>(max_crt_width))
+    return 0;
+  return x >= 1 ? std::uint64_t{7} << (x - 1) : std::uint64_t{7} >> (1 - x);
+}
+
+// Bit w is set iff pixel w of the scanline drawn while X takes the values
+// x_during is lit
+auto scanlineMask(std::span<const ptrdiff_t> x_during) -> std::uint64_t {
+  std::uint64_t retval{};
+  for (size_t w = 0; w < x_during.size(); ++w)
+    retval |= spriteMask(x_during[w]) & (std::uint64_t{1} << w);
+  return retval;
+}
+
+// Renders n_frames consecutive width x height frames (separated by an empty
+// line) into one buffer, so that they can be flushed with a single write. The
+// buffer is empty for n_frames == 0
+auto renderFrames(const RegisterTimeline &timeline, size_t width,
+                  size_t height, size_t n_frames) -> std::string {
+  if (width == 0 or width > max_crt_width or height == 0)
+    throw std::runtime_error{"invalid CRT size"};
+  if (n_frames == 0)
+    return {};
+  const auto frame_size = (width + 1) * height;
+  std::string retval(frame_size * n_frames + (n_frames - 1), '\n');
+  auto *out = retval.data();
+  for (size_t frame = 0; frame < n_frames; ++frame, ++out) {
+    for (size_t h = 0; h < height; ++h, ++out) {
+      const auto first_cycle = (frame * height + h) * width + 1;
+      const auto mask = scanlineMask(timeline.during(first_cycle, width));
+      for (size_t w = 0; w < width; ++w)
+        *out++ = ".#"[(mask >> w) & 1];
     }
-    std::cout << '\n';
   }
+  return retval;
+}
+
+void part2(const RegisterTimeline &timeline) {
+  const auto frame = renderFrames(timeline, 40, 6, 1);
+  std::cout.write(frame.data(), static_cast<std::streamsize>(frame.size()));
 }
 
-int main() {
+// Usage: aoc [signal cycles... | crt width height] < program.txt. With cycles
+// given, prints the sum of the signal strengths at those cycles instead of the
+// puzzle answers. In crt mode, every complete frame of the program is drawn
+int main(int argc, char *argv[]) {
+  const auto args = getArgs(argc, argv);
   const auto [alloc, data] = getStdinView();
-  part1(data);
-  part2(data);
+  const auto timeline = RegisterTimeline{decode(data)};
+  if (not args.empty() and args.front() == "signal"sv) {
+    std::vector<size_t> cycles;
+    std::ranges::transform(args | std::views::drop(1),
+                           std::back_inserter(cycles),
+                           [](auto arg) { return toNumber<size_t>(arg); });
+    std::cout << sumSignalStrengths(timeline, cycles) << '\n';
+    return 0;
+  }
+  if (args.size() == 3 and args.front() == "crt"sv) {
+    const auto width = toNumber<size_t>(args[1]),
+               height = toNumber<size_t>(args[2]);
+    const auto n_frames = timeline.numCycles() / std::max(width * height, 1ul);
+    const auto frames = renderFrames(timeline, width, height, n_frames);
+    std::cout.write(frames.data(), static_cast<std::streamsize>(frames.size()));
+    return 0;
+  }
+  part1(timeline);
+  part2(timeline);
 }
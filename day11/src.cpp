@@ -1,17 +1,38 @@
 #include "../common/common.hpp"
 
-#include <deque>
+#include <bit>
+#include <cstdint>
 #include <functional>
+#include <optional>
+#include <span>
 
 using item_t = size_t;
 
-struct Monkey {
-  std::deque<item_t> items;
-  std::function<item_t(item_t)> op;
-  item_t test_div, true_dest, false_dest, num_inspected{};
+// Worry level update compiled from "new = <arg> <op> <arg>"
+struct Operation {
+  enum struct Kind : std::uint8_t { Add, Mul, Square };
+  Kind kind;
+  item_t k;
+
+  item_t operator()(item_t old) const {
+    switch (kind) {
+    case Kind::Add:
+      return old + k;
+    case Kind::Mul:
+      return old * k;
+    case Kind::Square:
+      return old * old;
+    }
+    std::unreachable();
+  }
 };
 
-enum struct Ops { Plus, Mult };
+struct Monkey {
+  std::vector<item_t> starting_items;
+  Operation op;
+  item_t test_div;
+  size_t true_dest, false_dest, num_inspected{};
+};
 
 auto parseMonkey(std::string_view section) -> Monkey {
   auto lines = splitIntoLinesUntilEmpty(section);
@@ -26,7 +47,7 @@ auto parseMonkey(std::string_view section) -> Monkey {
     std::ranges::copy(line | std::views::split(", "sv) |
                           std::views::transform(
                               [](auto &&num) { return toNumber<item_t>(num); }),
-                      std::back_inserter(retval.items));
+                      std::back_inserter(retval.starting_items));
   }
 
   // Operation
@@ -37,17 +58,15 @@ auto parseMonkey(std::string_view section) -> Monkey {
     const auto arg1 = *word_it++;
     const auto op_str = *word_it++;
     const auto arg2 = *word_it;
-    static constexpr auto old = std::numeric_limits<item_t>::max();
-    retval.op = [al = (arg1 == "old"sv ? old : toNumber<item_t>(arg1)),
-                 ar = (arg2 == "old"sv ? old : toNumber<item_t>(arg2)),
-                 op = (op_str == "+"sv ? Ops::Plus : Ops::Mult)](auto arg) {
-      const auto a1 = (al == old ? arg : al);
-      const auto a2 = (ar == old ? arg : ar);
-      if (op == Ops::Plus)
-        return a1 + a2;
-      else
-        return a1 * a2;
-    };
+    using enum Operation::Kind;
+    const bool old1 = arg1 == "old"sv, old2 = arg2 == "old"sv;
+    const bool plus = op_str == "+"sv;
+    if (old1 and old2)
+      retval.op = plus ? Operation{Mul, 2} : Operation{Square, 0};
+    else if (old1 or old2)
+      retval.op = {plus ? Add : Mul, toNumber<item_t>(old1 ? arg2 : arg1)};
+    else
+      throw std::runtime_error{"operation does not depend on old"};
   }
 
   // Test + targets
@@ -65,76 +84,261 @@ auto parseMonkey(std::string_view section) -> Monkey {
   return retval;
 }
 
+auto parseMonkeys(std::string_view data) -> std::vector<Monkey> {
+  std::vector<Monkey> retval;
+  std::ranges::transform(splitIntoSections(data), std::back_inserter(retval),
+                         &parseMonkey);
+  for (const auto &monkey : retval)
+    if (monkey.true_dest >= retval.size() or monkey.false_dest >= retval.size())
+      throw std::runtime_error{"invalid target monkey"};
+  return retval;
+}
+
+// Worry levels can be reduced modulo this without changing any test result
+auto getDivProduct(const std::vector<Monkey> &monkeys) -> item_t {
+  auto div_range =
+      monkeys |
+      std::views::transform([](const Monkey &m) { return m.test_div; }) |
+      std::views::common;
+  return std::reduce(div_range.begin(), div_range.end(), item_t{1},
+                     std::multiplies{});
+}
+
+// Per-monkey FIFO ring buffers carved out of one flat array. Every buffer can
+// hold all items, so nothing is allocated once the game is set up
+class ItemQueues {
+public:
+  ItemQueues(size_t n_queues, size_t n_items)
+      : capacity_{std::bit_ceil(std::max(n_items, size_t{1}))},
+        slots_(n_queues * capacity_), head_(n_queues), size_(n_queues) {}
+
+  void push(size_t queue, item_t item) {
+    slots_[queue * capacity_ + ((head_[queue] + size_[queue]++) &
+                                (capacity_ - 1))] = item;
+  }
+  item_t pop(size_t queue) {
+    const auto item = slots_[queue * capacity_ + head_[queue]];
+    head_[queue] = (head_[queue] + 1) & (capacity_ - 1);
+    --size_[queue];
+    return item;
+  }
+  size_t size(size_t queue) const { return size_[queue]; }
+
+private:
+  size_t capacity_;
+  std::vector<item_t> slots_;
+  std::vector<size_t> head_, size_;
+};
+
 class Game {
 public:
-  Game(std::string_view data) {
-    std::ranges::transform(splitIntoSections(data),
-                           std::back_inserter(monkeys_), &parseMonkey);
-    auto div_range =
-        monkeys_ |
-        std::views::transform([](const Monkey &m) { return m.test_div; }) |
-        std::views::common;
-    div_prod_ = std::reduce(div_range.begin(), div_range.end(), item_t{1},
-                            std::multiplies{});
+  Game(std::string_view data)
+      : monkeys_{parseMonkeys(data)}, div_prod_{getDivProduct(monkeys_)} {
+    size_t n_items = 0;
+    for (const auto &monkey : monkeys_)
+      n_items += monkey.starting_items.size();
+    items_.emplace(monkeys_.size(), n_items);
+    for (size_t i = 0; i < monkeys_.size(); ++i)
+      for (auto item : monkeys_[i].starting_items)
+        items_->push(i, item);
   }
   void roundDropWorry() {
-    std::ranges::for_each(monkeys_, [&](Monkey &monkey) {
-      for (auto item : monkey.items) {
-        item = monkey.op(item);
-        item /= 3;
-        monkeys_[item % monkey.test_div == 0 ? monkey.true_dest
-                                             : monkey.false_dest]
-            .items.push_back(item);
-        ++monkey.num_inspected;
-      }
-      monkey.items.clear();
-    });
+    round([](item_t item) { return item / 3; });
   }
   void roundConstWorry() {
-    std::ranges::for_each(monkeys_, [&](Monkey &monkey) {
-      for (auto item : monkey.items) {
-        item = monkey.op(item);
-        if (item > div_prod_)
-          item %= div_prod_;
-        monkeys_[item % monkey.test_div == 0 ? monkey.true_dest
-                                             : monkey.false_dest]
-            .items.push_back(item);
-        ++monkey.num_inspected;
-      }
-      monkey.items.clear();
+    round([div_prod = div_prod_](item_t item) {
+      return item > div_prod ? item % div_prod : item;
     });
   }
-  size_t getMonkeyBusiness() const {
-    // -Warray-bounds triggers for size == 2, super weird
-    std::array<item_t, 3> top2{};
-    std::ranges::partial_sort_copy(
-        monkeys_ | std::views::transform(
-                       [](const Monkey &m) { return m.num_inspected; }),
-        top2, std::greater{});
-    return top2[0] * top2[1];
+  auto getInspectionCounts() const -> std::vector<size_t> {
+    std::vector<size_t> retval;
+    std::ranges::transform(monkeys_, std::back_inserter(retval),
+                           &Monkey::num_inspected);
+    return retval;
   }
 
 private:
+  void round(auto &&relieve) {
+    for (size_t i = 0; i < monkeys_.size(); ++i) {
+      auto &monkey = monkeys_[i];
+      const auto n_items = items_->size(i);
+      for (size_t j = 0; j < n_items; ++j) {
+        const auto item = relieve(monkey.op(items_->pop(i)));
+        items_->push(item % monkey.test_div == 0 ? monkey.true_dest
+                                                 : monkey.false_dest,
+                     item);
+      }
+      monkey.num_inspected += n_items;
+    }
+  }
+
   std::vector<Monkey> monkeys_;
-  size_t div_prod_{};
+  item_t div_prod_;
+  std::optional<ItemQueues> items_;
+};
+
+__extension__ using uint128_t = unsigned __int128;
+
+auto toString(uint128_t value) -> std::string {
+  std::string retval;
+  do {
+    retval.push_back(static_cast<char>('0' + value % 10));
+    value /= 10;
+  } while (value != 0);
+  std::ranges::reverse(retval);
+  return retval;
+}
+
+// 128 bits wide, as counts from huge round counts overflow when multiplied
+auto getMonkeyBusiness(std::span<const size_t> inspection_counts)
+    -> uint128_t {
+  // -Warray-bounds triggers for size == 2, super weird
+  std::array<size_t, 3> top2{};
+  std::ranges::partial_sort_copy(inspection_counts, top2, std::greater{});
+  return uint128_t{top2[0]} * top2[1];
+}
+
+// Alternative to Game::roundConstWorry which follows every item on its own,
+// as an item's path only depends on its worry level (modulo the product of
+// the divisors) and current monkey at the start of a round. Items run in
+// parallel, and once the state of an item at the start of a round repeats,
+// the inspections of the remaining full cycles are extrapolated
+class ItemSimulator {
+public:
+  ItemSimulator(const std::vector<Monkey> &monkeys)
+      : monkeys_{monkeys}, div_prod_{getDivProduct(monkeys)} {}
+
+  auto countInspections(size_t n_rounds) const -> std::vector<size_t> {
+    std::vector<State> items;
+    for (size_t i = 0; i < monkeys_.size(); ++i)
+      for (auto item : monkeys_[i].starting_items)
+        items.push_back({item % div_prod_, i});
+    std::vector<std::vector<size_t>> counts(items.size());
+    parallelFor(items.size(), [&](size_t i) {
+      counts[i] = countItemInspections(items[i], n_rounds);
+    });
+    std::vector<size_t> retval(monkeys_.size());
+    for (const auto &item_counts : counts)
+      for (size_t i = 0; i < retval.size(); ++i)
+        retval[i] += item_counts[i];
+    return retval;
+  }
+
+private:
+  struct State {
+    item_t worry;
+    size_t monkey;
+    bool operator==(const State &) const = default;
+  };
+
+  // Moves the item through one round, calling inspected(monkey) for every
+  // inspection. It stays with monkeys further down the line within the round
+  State round(State state, auto &&inspected) const {
+    while (true) {
+      const auto &monkey = monkeys_[state.monkey];
+      inspected(state.monkey);
+      state.worry = monkey.op(state.worry) % div_prod_;
+      const auto dest = state.worry % monkey.test_div == 0 ? monkey.true_dest
+                                                           : monkey.false_dest;
+      const bool next_round = dest <= state.monkey;
+      state.monkey = dest;
+      if (next_round)
+        return state;
+    }
+  }
+  State rounds(State state, size_t n_rounds,
+               std::vector<size_t> &counts) const {
+    const auto inspected = [&](size_t monkey) { ++counts[monkey]; };
+    for (size_t r = 0; r < n_rounds; ++r)
+      state = round(state, inspected);
+    return state;
+  }
+
+  // Finds the cycle of start-of-round states with Brent's algorithm, which
+  // needs no memory. Without a cycle within n_rounds, the rounds are simply
+  // simulated
+  auto countItemInspections(State start, size_t n_rounds) const
+      -> std::vector<size_t> {
+    std::vector<size_t> counts(monkeys_.size());
+    const auto next = [&](State s) { return round(s, [](size_t) {}); };
+    size_t power = 1, cycle_length = 1, n_steps = 1;
+    for (auto tortoise = start, hare = next(start); tortoise != hare;
+         hare = next(hare), ++cycle_length, ++n_steps) {
+      if (n_steps >= n_rounds) {
+        rounds(start, n_rounds, counts);
+        return counts;
+      }
+      if (power == cycle_length) {
+        tortoise = hare;
+        power *= 2;
+        cycle_length = 0;
+      }
+    }
+    auto tortoise = start, hare = start;
+    for (size_t i = 0; i < cycle_length; ++i)
+      hare = next(hare);
+    size_t cycle_start = 0;
+    for (; tortoise != hare; ++cycle_start) {
+      tortoise = next(tortoise);
+      hare = next(hare);
+    }
+
+    const auto prefix = std::min(cycle_start, n_rounds);
+    const auto cycle_entry = rounds(start, prefix, counts);
+    const auto n_cycles = (n_rounds - prefix) / cycle_length;
+    std::vector<size_t> cycle_counts(monkeys_.size());
+    rounds(cycle_entry, cycle_length, cycle_counts);
+    for (size_t i = 0; i < counts.size(); ++i)
+      counts[i] += n_cycles * cycle_counts[i];
+    rounds(cycle_entry, (n_rounds - prefix) % cycle_length, counts);
+    return counts;
+  }
+
+  const std::vector<Monkey> &monkeys_;
+  item_t div_prod_;
 };
 
 void part1(std::string_view data) {
   Game game(data);
   for (int round = 0; round < 20; ++round)
     game.roundDropWorry();
-  std::cout << game.getMonkeyBusiness() << '\n';
+  std::cout << toString(getMonkeyBusiness(game.getInspectionCounts())) << '\n';
 }
 
 void part2(std::string_view data) {
   Game game(data);
   for (int round = 0; round < 10'000; ++round)
     game.roundConstWorry();
-  std::cout << game.getMonkeyBusiness() << '\n';
+  std::cout << toString(getMonkeyBusiness(game.getInspectionCounts())) << '\n';
+}
+
+// Runs both part 2 engines for n_rounds and compares the inspection counts
+void check(std::string_view data, size_t n_rounds) {
+  Game game(data);
+  for (size_t round = 0; round < n_rounds; ++round)
+    game.roundConstWorry();
+  const auto monkeys = parseMonkeys(data);
+  if (ItemSimulator{monkeys}.countInspections(n_rounds) !=
+      game.getInspectionCounts())
+    throw std::runtime_error{"engines disagree"};
+  std::cout << "ok\n";
 }
 
-int main() {
+// Usage: aoc [rounds N | check [N]] < monkeys.txt. With rounds, prints the
+// monkey business after N rounds without worry relief, using the per-item
+// simulation. check compares it against the round based engine
+int main(int argc, char *argv[]) {
+  const auto args = getArgs(argc, argv);
   const auto [alloc, data] = getStdinView();
-  part1(data);
-  part2(data);
+  if (args.size() == 2 and args.front() == "rounds"sv) {
+    const auto monkeys = parseMonkeys(data);
+    const auto counts =
+        ItemSimulator{monkeys}.countInspections(toNumber<size_t>(args[1]));
+    std::cout << toString(getMonkeyBusiness(counts)) << '\n';
+  } else if (not args.empty() and args.front() == "check"sv)
+    check(data, args.size() > 1 ? toNumber<size_t>(args[1]) : 10'000);
+  else {
+    part1(data);
+    part2(data);
+  }
 }
@@ -1,6 +1,10 @@
+#include <cstdint>
 #include <deque>
+#include <fstream>
 #include <optional>
 #include <queue>
+#include <random>
+#include <span>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -40,7 +44,18 @@ public:
   char &operator()(pos_t pos) {
     return data_[pos.back() * width_ + pos.front()];
   }
+  // Cells are also addressed by their linear index y * width + x
+  char operator[](size_t index) const { return data_[index]; }
+  size_t index(pos_t pos) const {
+    return static_cast<size_t>(pos.back() * width_ + pos.front());
+  }
+  pos_t pos(size_t index) const {
+    const auto i = static_cast<ptrdiff_t>(index);
+    return {i % width_, i / width_};
+  }
+  size_t size() const { return data_.size(); }
   void setStart(pos_t pos) { start_ = pos; }
+  void setFinish(pos_t pos) { finish_ = pos; }
 
   auto start() const { return start_; }
   auto finish() const { return finish_; }
@@ -67,9 +82,11 @@ private:
   pos_t start_{}, finish_{};
 };
 
-// See https://en.wikipedia.org/wiki/A*_search_algorithm
-std::optional<size_t> A_star(const Board &board,
-                             DrawResult do_draw = DrawResult::no) {
+// Hash map based A*, kept as the reference for the benchmark. Scores of
+// positions already in the heap are updated in place, so it can miss the
+// shortest path
+std::optional<size_t> A_star_hashed(const Board &board,
+                                    DrawResult do_draw = DrawResult::no) {
   struct PosInfo {
     size_t cost, score;
     pos_t from;
@@ -162,43 +179,517 @@ std::optional<size_t> A_star(const Board &board,
   return {};
 }
 
-void part1(const Board &board, DrawResult draw) {
-  std::cout << *A_star(board, draw) << '\n';
+constexpr auto no_path = std::numeric_limits<size_t>::max();
+
+// Admissible and consistent estimate of the distance to the finish
+auto manhattanHeuristic(const Board &board) {
+  return [&board, finish = board.finish()](size_t index) {
+    const auto [x, y] = board.pos(index);
+    return static_cast<size_t>(std::abs(x - finish.front()) +
+                               std::abs(y - finish.back()));
+  };
+}
+
+// Per-cell A* state, reusable between searches on boards of the same size.
+// Searches only reset the cells they touched, so that short searches on large
+// boards do not pay for the whole board
+struct SearchBuffers {
+  using index_t = std::uint32_t;
+  static constexpr auto no_cost = std::numeric_limits<index_t>::max();
+
+  std::vector<index_t> cost, from, touched;
+  std::vector<size_t> score;
+  std::vector<std::vector<index_t>> buckets;
+
+  void prepare(size_t n_cells) {
+    if (n_cells >= no_cost)
+      throw std::runtime_error{"board too large"};
+    if (cost.size() != n_cells) {
+      cost.assign(n_cells, no_cost);
+      from.resize(n_cells);
+      score.resize(n_cells);
+    }
+  }
+  void reset() {
+    for (auto index : touched)
+      cost[index] = no_cost;
+    touched.clear();
+    for (auto &bucket : buckets)
+      bucket.clear();
+  }
+};
+
+// See https://en.wikipedia.org/wiki/A*_search_algorithm. Costs and
+// predecessors live in flat arrays over the linear cell index. As the
+// heuristic must be consistent and every step costs 1, the f-scores of
+// expanded cells never decrease, so the open set is a bucket queue indexed by
+// f-score. Stale entries are skipped when popped. Cells for which the heuristic
+// returns no_path (the finish cannot be reached from them) are never queued.
+// If given, *n_expanded is set to the number of expanded cells
+std::optional<size_t> A_star(const Board &board, DrawResult do_draw,
+                             auto &&heuristic, SearchBuffers &buffers,
+                             size_t *n_expanded = nullptr) {
+  using index_t = SearchBuffers::index_t;
+  buffers.prepare(board.size());
+  auto &[cost, from, touched, score, buckets] = buffers;
+  const auto width = static_cast<size_t>(board.width());
+  const auto start = board.index(board.start()),
+             finish = board.index(board.finish());
+
+  const auto push = [&](size_t index, index_t g_score) {
+    cost[index] = g_score;
+    touched.push_back(static_cast<index_t>(index));
+    const auto h_score = heuristic(index);
+    if (h_score == no_path)
+      return;
+    const auto f_score = g_score + h_score;
+    if (f_score >= buckets.size())
+      buckets.resize(f_score + 1);
+    buckets[f_score].push_back(static_cast<index_t>(index));
+    score[index] = f_score;
+  };
+  from[start] = static_cast<index_t>(start);
+  push(start, 0);
+
+  const auto draw = [&] {
+    Board path = board;
+    for (auto current = finish; current != start; current = from[current]) {
+      const auto previous = from[current];
+      path(board.pos(current)) =
+          current == previous + 1 or previous == current + 1 ? '-' : '|';
+    }
+    path.print();
+  };
+
+  if (n_expanded)
+    *n_expanded = 0;
+  std::optional<size_t> retval;
+  for (size_t f_score = 0; f_score < buckets.size() and not retval;
+       ++f_score) {
+    // Not a reference to the bucket, push may reallocate the buckets
+    while (not buckets[f_score].empty()) {
+      const size_t current = buckets[f_score].back();
+      buckets[f_score].pop_back();
+      if (score[current] != f_score)
+        continue;
+      if (n_expanded)
+        ++*n_expanded;
+      if (current == finish) {
+        if (do_draw == DrawResult::yes)
+          draw();
+        retval = cost[current];
+        break;
+      }
+      const auto x = current % width;
+      const auto tentative_cost = cost[current] + 1;
+      const auto visit = [&](size_t nbr) {
+        if (board[current] + 1 >= board[nbr] and tentative_cost < cost[nbr]) {
+          from[nbr] = static_cast<index_t>(current);
+          push(nbr, tentative_cost);
+        }
+      };
+      if (x + 1 < width)
+        visit(current + 1);
+      if (x > 0)
+        visit(current - 1);
+      if (current + width < board.size())
+        visit(current + width);
+      if (current >= width)
+        visit(current - width);
+    }
+  }
+  buffers.reset();
+  return retval;
+}
+
+std::optional<size_t> A_star(const Board &board,
+                             DrawResult do_draw = DrawResult::no) {
+  SearchBuffers buffers;
+  return A_star(board, do_draw, manhattanHeuristic(board), buffers);
+}
+
+// Number of steps from every cell to the source (by default the finish), from a
+// single BFS starting at the source and following the climbing rule backwards.
+// Or, with Direction::from_source, the number of steps from the source to
+// every cell
+class DistanceField {
+public:
+  enum struct Direction { to_source, from_source };
+  static constexpr auto unreachable = std::numeric_limits<size_t>::max();
+
+  DistanceField(const Board &board)
+      : DistanceField(board, board.finish(), Direction::to_source) {}
+  DistanceField(const Board &board, pos_t source, Direction direction)
+      : width_{board.width()},
+        dist_(static_cast<size_t>(board.width() * board.height()),
+              unreachable) {
+    std::vector<pos_t> queue;
+    queue.reserve(dist_.size());
+    queue.push_back(source);
+    (*this)(source) = 0;
+    for (size_t i = 0; i < queue.size(); ++i) {
+      const auto current = queue[i];
+      const auto nbr_dist = (*this)(current) + 1;
+      for (auto nbr_inc :
+           std::array<pos_t, 4>{{{1, 0}, {-1, 0}, {0, 1}, {0, -1}}}) {
+        const auto nbr = pos_t{current.front() + nbr_inc.front(),
+                               current.back() + nbr_inc.back()};
+        const auto [x, y] = nbr;
+        if (x < 0 or x >= board.width() or y < 0 or y >= board.height())
+          continue;
+        const auto [climb_from, climb_to] = direction == Direction::to_source
+                                                ? std::pair{nbr, current}
+                                                : std::pair{current, nbr};
+        if (board(climb_from) + 1 >= board(climb_to) and
+            (*this)(nbr) == unreachable) {
+          (*this)(nbr) = nbr_dist;
+          queue.push_back(nbr);
+        }
+      }
+    }
+  }
+  size_t operator()(pos_t pos) const {
+    return dist_[static_cast<size_t>(pos.back() * width_ + pos.front())];
+  }
+
+private:
+  size_t &operator()(pos_t pos) {
+    return dist_[static_cast<size_t>(pos.back() * width_ + pos.front())];
+  }
+
+  ptrdiff_t width_;
+  std::vector<size_t> dist_;
+};
+
+// Landmark (ALT) lower bounds on the distance between any two cells. From the
+// distances to and from a few landmarks L, the triangle inequality gives
+// d(v, t) >= d(v, L) - d(t, L) and d(v, t) >= d(L, t) - d(L, v). Landmarks are
+// picked one by one as the cell farthest from those already chosen
+class LandmarkTable {
+public:
+  using dist_t = std::uint32_t;
+  static constexpr auto unreachable = std::numeric_limits<dist_t>::max();
+  static constexpr std::int64_t max_distance = unreachable / 2;
+
+  LandmarkTable(const Board &board, size_t n_landmarks)
+      : n_landmarks_{std::min(n_landmarks, board.size())},
+        board_hash_{hashBoard(board)},
+        dist_(board.size() * 2 * n_landmarks_) {
+    if (n_landmarks_ == 0)
+      throw std::runtime_error{"at least one landmark is needed"};
+    if (board.size() > max_distance)
+      throw std::runtime_error{"board too large"};
+    using enum DistanceField::Direction;
+    std::vector<size_t> closest(board.size(), DistanceField::unreachable);
+    size_t landmark = 0;
+    for (size_t l = 0; l < n_landmarks_; ++l) {
+      const auto pos = board.pos(landmark);
+      const DistanceField to{board, pos, to_source},
+          from{board, pos, from_source};
+      for (size_t i = 0; i < board.size(); ++i) {
+        const auto to_dist = to(board.pos(i)), from_dist = from(board.pos(i));
+        toLandmark(i)[l] = toDist(to_dist);
+        fromLandmark(i)[l] = toDist(from_dist);
+        closest[i] = std::min({closest[i], to_dist, from_dist});
+      }
+      landmark = static_cast<size_t>(
+          std::distance(closest.begin(), std::ranges::max_element(closest)));
+    }
+  }
+
+  // Nullopt if the file does not hold a table for this board
+  static auto load(const std::string &path, const Board &board)
+      -> std::optional<LandmarkTable> {
+    std::ifstream in{path, std::ios::binary};
+    std::array<std::uint64_t, 3> header{};
+    if (not in.read(reinterpret_cast<char *>(header.data()), sizeof(header)))
+      return {};
+    const auto [n_landmarks, n_cells, board_hash] = header;
+    if (n_landmarks == 0 or n_cells != board.size() or
+        board_hash != hashBoard(board))
+      return {};
+    LandmarkTable retval{n_landmarks, board_hash, board.size()};
+    if (not in.read(reinterpret_cast<char *>(retval.dist_.data()),
+                    static_cast<std::streamsize>(retval.dist_.size() *
+                                                 sizeof(dist_t))))
+      return {};
+    return retval;
+  }
+  void save(const std::string &path) const {
+    std::ofstream out{path, std::ios::binary};
+    const std::array<std::uint64_t, 3> header{n_landmarks_, numCells(),
+                                              board_hash_};
+    out.write(reinterpret_cast<const char *>(header.data()), sizeof(header));
+    out.write(reinterpret_cast<const char *>(dist_.data()),
+              static_cast<std::streamsize>(dist_.size() * sizeof(dist_t)));
+    if (not out)
+      throw std::runtime_error{"cannot write landmark table"};
+  }
+
+  size_t numLandmarks() const { return n_landmarks_; }
+
+  // Consistent heuristic for A* towards the finish of board, at least as tight
+  // as the Manhattan distance. It is no_path if a landmark proves the finish
+  // unreachable: a cell which cannot reach a landmark the finish reaches, or
+  // which a landmark reaches while it does not reach the finish. Computed with
+  // the raw distances, where such cases stand out as differences close to
+  // unreachable, and other bounds involving unreachable distances are <= 0
+  auto heuristic(const Board &board) const {
+    const auto goal_index = board.index(board.finish());
+    return [this, manhattan = manhattanHeuristic(board), goal_index](
+               size_t index) {
+      const auto *to = toLandmark(index), *from = fromLandmark(index);
+      const auto *goal_to = toLandmark(goal_index),
+                 *goal_from = fromLandmark(goal_index);
+      std::int64_t bound = 0;
+      for (size_t l = 0; l < n_landmarks_; ++l)
+        bound = std::max({bound, std::int64_t{to[l]} - goal_to[l],
+                          std::int64_t{goal_from[l]} - from[l]});
+      if (bound > max_distance)
+        return no_path;
+      return std::max(manhattan(index), static_cast<size_t>(bound));
+    };
+  }
+
+private:
+  LandmarkTable(size_t n_landmarks, std::uint64_t board_hash, size_t n_cells)
+      : n_landmarks_{n_landmarks}, board_hash_{board_hash},
+        dist_(n_cells * 2 * n_landmarks) {}
+
+  // FNV-1a over the size and heights of the board
+  static auto hashBoard(const Board &board) -> std::uint64_t {
+    std::uint64_t retval = 0xcbf29ce484222325;
+    const auto mix = [&](std::uint64_t value) {
+      retval = (retval ^ value) * 0x100000001b3;
+    };
+    mix(static_cast<std::uint64_t>(board.width()));
+    for (size_t i = 0; i < board.size(); ++i)
+      mix(static_cast<unsigned char>(board[i]));
+    return retval;
+  }
+  static auto toDist(size_t dist) -> dist_t {
+    return dist == DistanceField::unreachable ? unreachable
+                                              : static_cast<dist_t>(dist);
+  }
+  size_t numCells() const { return dist_.size() / (2 * n_landmarks_); }
+
+  // Per cell, the distances to every landmark then from every landmark
+  dist_t *toLandmark(size_t index) {
+    return dist_.data() + index * 2 * n_landmarks_;
+  }
+  dist_t *fromLandmark(size_t index) {
+    return toLandmark(index) + n_landmarks_;
+  }
+  const dist_t *toLandmark(size_t index) const {
+    return dist_.data() + index * 2 * n_landmarks_;
+  }
+  const dist_t *fromLandmark(size_t index) const {
+    return toLandmark(index) + n_landmarks_;
+  }
+
+  size_t n_landmarks_;
+  std::uint64_t board_hash_;
+  std::vector<dist_t> dist_;
+};
+
+void part1(const Board &board, const DistanceField &dist, DrawResult draw) {
+  if (draw == DrawResult::yes)
+    A_star(board, draw);
+  std::cout << dist(board.start()) << '\n';
 }
 
-void part2(Board &board, DrawResult draw) {
-  // Just brute force it, we have the cycles (but not the time to figure out a
-  // smarter algo)
-  size_t min_path = std::numeric_limits<size_t>::max();
+void part2(Board &board, const DistanceField &dist, DrawResult draw) {
+  size_t min_path = DistanceField::unreachable;
   pos_t min_pos{};
   for (ptrdiff_t y = 0; y < board.height(); ++y)
     for (ptrdiff_t x = 0; x < board.width(); ++x) {
       const auto pos = pos_t{x, y};
-      if (board(pos) == 'a') {
-        board.setStart(pos);
-        const auto shortest_path = A_star(board);
-        if (shortest_path)
-          if (min_path > *shortest_path) {
-            min_path = *shortest_path;
-            min_pos = pos;
-          }
+      if (board(pos) == 'a' and dist(pos) < min_path) {
+        min_path = dist(pos);
+        min_pos = pos;
       }
     }
   if (draw == DrawResult::yes) {
     board.setStart(min_pos);
-    *A_star(board, DrawResult::yes);
+    A_star(board, DrawResult::yes);
   }
   std::cout << min_path << '\n';
 }
 
-int main() {
+// Times both A* implementations on searches from up to max_starts 'a' cells
+// spread over the map, checking the path lengths against the distance field
+void benchmark(Board &board, const DistanceField &dist, size_t max_starts) {
+  std::vector<pos_t> starts;
+  for (size_t i = 0; i < board.size(); ++i)
+    if (board[i] == 'a')
+      starts.push_back(board.pos(i));
+  if (starts.size() > max_starts) {
+    const auto stride = starts.size() / max_starts;
+    for (size_t i = 0; i < max_starts; ++i)
+      starts[i] = starts[i * stride];
+    starts.resize(max_starts);
+  }
+  const auto original_start = board.start();
+  const auto run = [&](auto &&search, std::string_view name) {
+    size_t n_wrong = 0;
+    const auto time = measureSeconds([&] {
+      for (auto start : starts) {
+        board.setStart(start);
+        const auto length = search(board, DrawResult::no);
+        n_wrong += length.value_or(DistanceField::unreachable) != dist(start);
+      }
+    });
+    std::cout << name << ": " << time / static_cast<double>(starts.size())
+              << " s/search, " << n_wrong << " of " << starts.size()
+              << " path lengths wrong\n";
+  };
+  run([](const Board &b, DrawResult d) { return A_star(b, d); }, "dense A* ");
+  run(A_star_hashed, "hashed A*");
+  board.setStart(original_start);
+}
+
+// Answers start -> goal queries (given as sx sy gx gy quadruples) with A*
+// guided by the landmark table
+void routeQueries(Board board, const LandmarkTable &landmarks,
+                  std::span<const std::string_view> args) {
+  if (args.size() % 4 != 0)
+    throw std::runtime_error{"expected sx sy gx gy quadruples"};
+  const auto toPos = [&](size_t i) {
+    const auto pos =
+        pos_t{toNumber<ptrdiff_t>(args[i]), toNumber<ptrdiff_t>(args[i + 1])};
+    if (pos.front() < 0 or pos.front() >= board.width() or pos.back() < 0 or
+        pos.back() >= board.height())
+      throw std::runtime_error{"position outside of the map"};
+    return pos;
+  };
+  SearchBuffers buffers;
+  for (size_t i = 0; i < args.size(); i += 4) {
+    const auto start = toPos(i), goal = toPos(i + 2);
+    board.setStart(start);
+    board.setFinish(goal);
+    const auto length =
+        A_star(board, DrawResult::no, landmarks.heuristic(board), buffers);
+    std::cout << start.front() << ',' << start.back() << " -> " << goal.front()
+              << ',' << goal.back() << ": ";
+    if (length)
+      std::cout << *length << '\n';
+    else
+      std::cout << "unreachable\n";
+  }
+}
+
+// Compares A* with the landmark and the Manhattan heuristics on n_queries
+// random start -> goal queries, reporting throughput and expanded cells
+void benchmarkRoutes(Board board, const LandmarkTable &landmarks,
+                     size_t n_queries) {
+  std::mt19937 gen{42};
+  std::uniform_int_distribution<size_t> cell_dist{0, board.size() - 1};
+  std::vector<std::array<pos_t, 2>> queries(n_queries);
+  std::ranges::generate(queries, [&] {
+    return std::array{board.pos(cell_dist(gen)), board.pos(cell_dist(gen))};
+  });
+  std::vector<std::optional<size_t>> lengths(n_queries), ref_lengths(n_queries);
+  SearchBuffers buffers;
+  const auto run = [&](auto &&makeHeuristic, auto &results) {
+    size_t n_expanded_total = 0;
+    const auto time = measureSeconds([&] {
+      for (size_t i = 0; i < n_queries; ++i) {
+        board.setStart(queries[i].front());
+        board.setFinish(queries[i].back());
+        size_t n_expanded{};
+        results[i] = A_star(board, DrawResult::no, makeHeuristic(board),
+                            buffers, &n_expanded);
+        n_expanded_total += n_expanded;
+      }
+    });
+    return std::pair{time, n_expanded_total};
+  };
+  const auto [time, n_expanded] = run(
+      [&](const Board &b) { return landmarks.heuristic(b); }, lengths);
+  const auto [ref_time, ref_n_expanded] = run(
+      [](const Board &b) { return manhattanHeuristic(b); }, ref_lengths);
+  const auto n = static_cast<double>(n_queries);
+  std::cout << "ALT (" << landmarks.numLandmarks()
+            << " landmarks): " << n / time << " queries/s, "
+            << static_cast<double>(n_expanded) / n << " cells expanded/query\n"
+            << "Manhattan:        " << n / ref_time << " queries/s, "
+            << static_cast<double>(ref_n_expanded) / n
+            << " cells expanded/query\n";
+  if (lengths != ref_lengths)
+    throw std::runtime_error{"path lengths differ"};
+}
+
+// Builds the landmark table, or loads it from the table file when it matches
+// the board (saving it there otherwise), then runs the queries or benchmark
+void landmarkMode(const Board &board, std::span<const std::string_view> args) {
+  if (args.empty())
+    throw std::runtime_error{"expected the number of landmarks"};
+  const auto n_landmarks = toNumber<size_t>(args.front());
+  args = args.subspan(1);
+  std::optional<std::string> path;
+  if (args.size() >= 2 and args.front() == "table"sv) {
+    path = args[1];
+    args = args.subspan(2);
+  }
+  std::optional<LandmarkTable> landmarks;
+  const auto build_time = measureSeconds([&] {
+    if (path)
+      landmarks = LandmarkTable::load(*path, board);
+    if (not landmarks or landmarks->numLandmarks() != n_landmarks) {
+      landmarks.emplace(board, n_landmarks);
+      if (path)
+        landmarks->save(*path);
+    }
+  });
+  if (not args.empty() and args.front() == "bench"sv) {
+    std::cout << "landmark table ready in " << build_time << " s\n";
+    benchmarkRoutes(board, *landmarks,
+                    args.size() > 1 ? toNumber<size_t>(args[1]) : 1000);
+  } else
+    routeQueries(board, *landmarks, args);
+}
+
+// Usage: aoc [from x y... | bench [N] | alt K [table FILE] [sx sy gx gy... |
+// bench [N]]] < map.txt. With positions given, prints the length of the
+// shortest path from each of them to the finish. bench times A* searches from
+// N (100 by default) lowest cells. alt answers start -> goal queries with a K
+// landmark table, or benchmarks N random queries against plain A*
+int main(int argc, char *argv[]) {
+  const auto args = getArgs(argc, argv);
   const auto [alloc, data] = getStdinView();
   Board board{data};
+  const DistanceField dist{board};
+
+  if (not args.empty() and args.front() == "from"sv) {
+    if (args.size() % 2 == 0)
+      throw std::runtime_error{"expected x y pairs"};
+    for (size_t i = 1; i < args.size(); i += 2) {
+      const auto pos = pos_t{toNumber<ptrdiff_t>(args[i]),
+                             toNumber<ptrdiff_t>(args[i + 1])};
+      if (pos.front() < 0 or pos.front() >= board.width() or pos.back() < 0 or
+          pos.back() >= board.height())
+        throw std::runtime_error{"position outside of the map"};
+      std::cout << pos.front() << ',' << pos.back() << ": ";
+      if (dist(pos) == DistanceField::unreachable)
+        std::cout << "unreachable\n";
+      else
+        std::cout << dist(pos) << '\n';
+    }
+    return 0;
+  }
+  if (not args.empty() and args.front() == "bench"sv) {
+    benchmark(board, dist, args.size() > 1 ? toNumber<size_t>(args[1]) : 100);
+    return 0;
+  }
+  if (not args.empty() and args.front() == "alt"sv) {
+    landmarkMode(board, std::span{args}.subspan(1));
+    return 0;
+  }
 
   constexpr auto draw_results = DrawResult::no;
   if constexpr (draw_results == DrawResult::yes)
     board.print();
 
-  part1(board, draw_results);
-  part2(board, draw_results);
+  part1(board, dist, draw_results);
+  part2(board, dist, draw_results);
 }
@@ -1,8 +1,14 @@
+#include <compare>
+#include <cstdint>
+#include <random>
+#include <span>
 #include <stack>
 #include <variant>
 
 #include "../common/common.hpp"
 
+// Parsed form of a packet, only built on request (see the parse and check
+// modes), the puzzle is solved by comparing the packet tokens directly
 struct List {
   using entry_t = std::variant<List, unsigned>;
   std::vector<entry_t> content;
@@ -73,69 +79,329 @@ auto parseList(std::string_view line) -> List {
   return root;
 }
 
+enum struct Token : std::uint8_t { Open, Close, Int, End };
+
+// Flat encoding of a packet, one token per bracket or integer
+using token_t = std::uint32_t;
+constexpr auto open_token = std::numeric_limits<token_t>::max(),
+               close_token = open_token - 1;
+
+// Appends the decimal digit c to value. Packet values must stay below
+// close_token, so that the text and flat comparisons agree
+auto appendDigit(token_t value, char c) -> token_t {
+  const auto retval =
+      std::uint64_t{value} * 10 + static_cast<std::uint64_t>(c - '0');
+  if (retval >= close_token)
+    throw std::runtime_error{"packet value too large"};
+  return static_cast<token_t>(retval);
+}
+
+// Reads the tokens of a packet string
+class TextTokens {
+public:
+  TextTokens(std::string_view packet) : rest_{packet} {}
+
+  Token peek() {
+    while (not rest_.empty() and rest_.front() == ',')
+      rest_.remove_prefix(1);
+    if (rest_.empty())
+      return Token::End;
+    switch (rest_.front()) {
+    case '[':
+      return Token::Open;
+    case ']':
+      return Token::Close;
+    default:
+      if (rest_.front() < '0' or rest_.front() > '9')
+        throw std::runtime_error{"unexpected character in packet"};
+      return Token::Int;
+    }
+  }
+  void skip() { rest_.remove_prefix(1); }
+  unsigned takeInt() {
+    token_t retval = 0;
+    for (; not rest_.empty() and rest_.front() >= '0' and rest_.front() <= '9';
+         rest_.remove_prefix(1))
+      retval = appendDigit(retval, rest_.front());
+    return retval;
+  }
+
+private:
+  std::string_view rest_;
+};
+
+class FlatTokens {
+public:
+  FlatTokens(std::span<const token_t> packet) : rest_{packet} {}
+
+  Token peek() const {
+    if (rest_.empty())
+      return Token::End;
+    switch (rest_.front()) {
+    case open_token:
+      return Token::Open;
+    case close_token:
+      return Token::Close;
+    default:
+      return Token::Int;
+    }
+  }
+  void skip() { rest_ = rest_.subspan(1); }
+  unsigned takeInt() {
+    const auto retval = rest_.front();
+    skip();
+    return retval;
+  }
+
+private:
+  std::span<const token_t> rest_;
+};
+
+// Walks the tokens of a packet. An integer compared against a list is wrapped
+// in lists virtually: the brackets opened on the other side are counted, and
+// the matching closing brackets are owed once the integer is taken
+template <typename Tokens> class PacketCursor {
+public:
+  PacketCursor(Tokens tokens) : tokens_{tokens} {}
+
+  Token peek() { return owed_closes_ > 0 ? Token::Close : tokens_.peek(); }
+  // Takes the bracket at the cursor
+  void take() {
+    if (owed_closes_ > 0)
+      --owed_closes_;
+    else
+      tokens_.skip();
+  }
+  unsigned takeInt() {
+    owed_closes_ += wraps_;
+    wraps_ = 0;
+    return tokens_.takeInt();
+  }
+  // Treats the integer at the cursor as the first entry of a list whose
+  // opening bracket has just been taken
+  void wrapInt() { ++wraps_; }
+
+private:
+  Tokens tokens_;
+  unsigned wraps_{}, owed_closes_{};
+};
+
+// Compares two packets in lockstep without building them, so nothing is
+// allocated. The packets may be read from different token sources
+auto comparePackets(auto lhs, auto rhs) -> std::weak_ordering {
+  PacketCursor l{lhs}, r{rhs};
+  while (true) {
+    const auto l_token = l.peek(), r_token = r.peek();
+    if (l_token == Token::End or r_token == Token::End)
+      return (r_token == Token::End) <=> (l_token == Token::End);
+    if (l_token == r_token) {
+      if (l_token == Token::Int) {
+        const auto l_val = l.takeInt(), r_val = r.takeInt();
+        if (l_val != r_val)
+          return l_val <=> r_val;
+      } else {
+        l.take();
+        r.take();
+      }
+    } else if (l_token == Token::Close)
+      return std::weak_ordering::less;
+    else if (r_token == Token::Close)
+      return std::weak_ordering::greater;
+    else if (l_token == Token::Int) {
+      r.take();
+      l.wrapInt();
+    } else {
+      l.take();
+      r.wrapInt();
+    }
+  }
+}
+
+bool packetLess(std::string_view lhs, std::string_view rhs) {
+  return comparePackets(TextTokens{lhs}, TextTokens{rhs}) < 0;
+}
+
+// All packets encoded back to back into one token array
+class FlatPackets {
+public:
+  void push_back(std::string_view packet) {
+    for (size_t i = 0; i < packet.size(); ++i) {
+      switch (packet[i]) {
+      case '[':
+        tokens_.push_back(open_token);
+        break;
+      case ']':
+        tokens_.push_back(close_token);
+        break;
+      case ',':
+        break;
+      default:
+        if (packet[i] < '0' or packet[i] > '9')
+          throw std::runtime_error{"unexpected character in packet"};
+        token_t value = 0;
+        for (; i < packet.size() and packet[i] >= '0' and packet[i] <= '9'; ++i)
+          value = appendDigit(value, packet[i]);
+        tokens_.push_back(value);
+        --i;
+      }
+    }
+    ends_.push_back(tokens_.size());
+  }
+  auto operator[](size_t packet) const -> std::span<const token_t> {
+    const auto begin = packet == 0 ? 0 : ends_[packet - 1];
+    return std::span{tokens_}.subspan(begin, ends_[packet] - begin);
+  }
+  size_t size() const { return ends_.size(); }
+
+private:
+  std::vector<token_t> tokens_;
+  std::vector<size_t> ends_;
+};
+
+bool flatPacketLess(std::span<const token_t> lhs,
+                    std::span<const token_t> rhs) {
+  return comparePackets(FlatTokens{lhs}, FlatTokens{rhs}) < 0;
+}
+
+// The encoded packets in sorted order, sorted in parallel
+auto sortPackets(const FlatPackets &packets)
+    -> std::vector<std::span<const token_t>> {
+  std::vector<std::span<const token_t>> retval;
+  retval.reserve(packets.size());
+  for (size_t i = 0; i < packets.size(); ++i)
+    retval.push_back(packets[i]);
+  parallelSort(retval.begin(), retval.end(), &flatPacketLess);
+  return retval;
+}
+
 void part1(std::string_view data) {
   size_t ind_sum = 0;
   for (size_t ind = 1; auto &&sec : splitIntoSections(data)) {
     auto lines = splitIntoLinesUntilEmpty(sec);
     auto lines_begin = std::ranges::begin(lines);
-    const auto l1 = parseList(*lines_begin++);
-    const auto l2 = parseList(*lines_begin);
-    if (l1 < l2)
+    const std::string_view l1 = *lines_begin++;
+    const std::string_view l2 = *lines_begin;
+    if (packetLess(l1, l2))
       ind_sum += ind;
     ++ind;
   }
   std::cout << ind_sum << '\n';
 }
 
-// Note: there is a much cleaner way to do this using the <=> operator for both
-// sorting and finding the divider packets, but I couldn't get it to compile in
-// a reasonable amount of time
-void part2(std::string_view data) {
-  std::vector<List> lists;
-  std::ranges::transform(
+auto getPackets(std::string_view data) -> std::vector<std::string_view> {
+  std::vector<std::string_view> retval;
+  std::ranges::copy(
       data | std::views::split("\n"sv) | std::views::transform([](auto &&line) {
         return std::string_view{line};
       }) | std::views::filter([](auto line) { return not line.empty(); }),
-      std::back_inserter(lists), [](auto line) { return parseList(line); });
-
-  // Add divider packets
-  {
-    List div_packet;
-    auto &nested_list = std::get<List>(
-        div_packet.content.emplace_back(std::in_place_type<List>));
-    auto &val = nested_list.content.emplace_back(2u);
-    lists.push_back(div_packet);
-    val = 6u;
-    lists.push_back(std::move(div_packet));
-  }
-
-  std::sort(lists.begin(), lists.end());
-
-  // Returns true for l == [[value]]
-  const auto findNestedVal = [](const List &l, unsigned value) {
-    if (l.content.size() == 1)
-      if (const auto nested =
-              std::get_if<List>(std::addressof(l.content.front()));
-          nested)
-        if (nested->content.size() == 1)
-          if (const auto val_ptr = std::get_if<unsigned>(
-                  std::addressof(nested->content.front()));
-              val_ptr)
-            if (*val_ptr == value)
-              return true;
-    return false;
+      std::back_inserter(retval));
+  return retval;
+}
+
+void part2(std::string_view data) {
+  FlatPackets packets;
+  for (auto packet : getPackets(data))
+    packets.push_back(packet);
+  const auto div_packet2 = packets.size(), div_packet6 = div_packet2 + 1;
+  packets.push_back("[[2]]"sv);
+  packets.push_back("[[6]]"sv);
+  const auto sorted = sortPackets(packets);
+  // Equivalent packets (like [2] for [[2]]) are not counted as before
+  const auto getIndex = [&](size_t div_packet) {
+    const auto first = std::ranges::partition_point(sorted, [&](auto packet) {
+      return flatPacketLess(packet, packets[div_packet]);
+    });
+    return std::distance(sorted.begin(), first) + 1;
   };
-  const auto it2 = std::ranges::find_if(
-      lists, [&findNestedVal](const List &l) { return findNestedVal(l, 2); });
-  const auto it6 = std::ranges::find_if(
-      lists, [&findNestedVal](const List &l) { return findNestedVal(l, 6); });
-  const auto index2 = std::distance(lists.begin(), it2) + 1;
-  const auto index6 = std::distance(lists.begin(), it6) + 1;
-  std::cout << index2 * index6 << '\n';
+  std::cout << getIndex(div_packet2) * getIndex(div_packet6) << '\n';
 }
 
-int main() {
+// Prints every packet from its parsed form
+void printParsed(std::string_view data) {
+  for (auto packet : getPackets(data)) {
+    parseList(packet).print();
+    std::cout << '\n';
+  }
+}
+
+// Checks the streaming comparator against the parsed packets on all pairs of
+// consecutive packets, both ways round
+void check(std::string_view data) {
+  const auto packets = getPackets(data);
+  std::vector<List> lists;
+  std::ranges::transform(packets, std::back_inserter(lists), &parseList);
+  for (size_t i = 0; i + 1 < packets.size(); ++i)
+    for (auto [a, b] : {std::pair{i, i + 1}, std::pair{i + 1, i}})
+      if (packetLess(packets[a], packets[b]) != (lists[a] < lists[b]))
+        throw std::runtime_error{"comparators disagree on lines " +
+                                 std::to_string(a + 1) + " and " +
+                                 std::to_string(b + 1)};
+  std::cout << "ok\n";
+}
+
+// Random packet of up to max_depth nested lists, appended to out
+void appendRandomPacket(std::string &out, std::mt19937 &gen, int max_depth) {
+  std::uniform_int_distribution<int> len_dist{0, 4}, val_dist{0, 10},
+      kind_dist{0, 2};
+  out.push_back('[');
+  for (int i = 0, len = len_dist(gen); i < len; ++i) {
+    if (i > 0)
+      out.push_back(',');
+    if (max_depth > 0 and kind_dist(gen) == 0)
+      appendRandomPacket(out, gen, max_depth - 1);
+    else
+      out += std::to_string(val_dist(gen));
+  }
+  out.push_back(']');
+}
+
+// Sorts n_packets random packets as strings with the streaming comparator and
+// through the flat encoding, and checks that both orders agree
+void benchmark(size_t n_packets) {
+  std::mt19937 gen{42};
+  std::string text;
+  for (size_t i = 0; i < n_packets; ++i) {
+    appendRandomPacket(text, gen, 4);
+    text.push_back('\n');
+  }
+  auto strings = getPackets(text);
+  const auto string_time =
+      measureSeconds([&] { std::ranges::sort(strings, &packetLess); });
+  FlatPackets packets;
+  std::vector<std::span<const token_t>> sorted;
+  const auto encode_time = measureSeconds([&] {
+    for (auto packet : getPackets(text))
+      packets.push_back(packet);
+  });
+  const auto flat_time = measureSeconds([&] { sorted = sortPackets(packets); });
+  for (size_t i = 0; i < n_packets; ++i) {
+    const TextTokens string_packet{strings[i]};
+    const FlatTokens flat_packet{sorted[i]};
+    if (comparePackets(string_packet, flat_packet) != 0)
+      throw std::runtime_error{"sort orders disagree"};
+  }
+  std::cout << n_packets << " packets (" << text.size() << " bytes)\n"
+            << "strings: " << string_time << " s\n"
+            << "flat:    " << flat_time << " s on " << getNumThreads()
+            << " threads, plus " << encode_time << " s encoding\n";
+}
+
+// Usage: aoc [parse | check | bench [N]] < packets.txt. parse prints the parsed
+// packets, check compares the streaming comparator with the parsed packets'
+// ordering. bench times sorting N random packets (without reading stdin)
+int main(int argc, char *argv[]) {
+  const auto args = getArgs(argc, argv);
+  if (not args.empty() and args.front() == "bench"sv) {
+    benchmark(args.size() > 1 ? toNumber<size_t>(args[1]) : 1'000'000);
+    return 0;
+  }
   const auto [alloc, data] = getStdinView();
-  part1(data);
-  part2(data);
+  if (not args.empty() and args.front() == "parse"sv)
+    printParsed(data);
+  else if (not args.empty() and args.front() == "check"sv)
+    check(data);
+  else {
+    part1(data);
+    part2(data);
+  }
 }